@@ -7,12 +7,40 @@
 #include <ctime>
 #include <cstdio>
 #include <cctype>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <random>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MUSAFIR_X86 1
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#include <io.h>
+#endif
 using namespace std;
 //constants
 const int WINDOW_WIDTH = 1024;
 const int WINDOW_HEIGHT = 768;
-const int MAX_HOTELS = 60;
-const int MAX_BOOKINGS = 50;
 const int MAX_CITIES = 7;
 const int MAX_GUESTS_PER_ROOM = 4;
 const int TRAVEL_GOAL = 5;
@@ -27,55 +55,206 @@ const string CITIES[MAX_CITIES] = {
     "Islamabad", "Lahore", "Karachi", "Peshawar",
     "Quetta", "Gilgit", "Muzaffarabad"
 };
+//Rooms per hotel when the catalog does not list them
+const int CATEGORY_ROOMS[MAX_CATEGORIES] = {120, 40, 80, 60, 30};
+//Travel mode price multipliers per category (row 0 = luxury mode, row 1 = budget mode)
+const float MODE_MULTIPLIERS[2][MAX_CATEGORIES] = {
+    {1.15f, 1.0f, 1.0f, 1.10f, 1.0f},  // Luxury mode adds service fees on luxury hotels
+    {1.0f, 0.90f, 1.0f, 1.0f, 0.95f}   // Budget mode gives discounts on budget hotels
+};
 const Color BG_LIGHT = {249, 250, 251, 255};  //Gui colors 
 const Color BG_WHITE = {255, 255, 255, 255};    
 const Color PAK_GREEN = {0, 102, 51, 255}; 
 const Color D_RED = {239, 68, 68, 255};    
 const Color SUCCESS_GREEN = {34, 197, 94, 255};
 //Data structures
+//Calendar: a date is a DayNumber, days since 01-01-1970 in the Gregorian
+//calendar. Dates are compared and stepped as integers and only turned into
+//day / month / year for display and the date pickers.
+typedef int DayNumber;
+struct CivilDate {
+    int year;
+    int month;
+    int day;
+};
+constexpr bool isLeapYear(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+constexpr int daysInMonth(int year, int month) {
+    return month == 2 ? (isLeapYear(year) ? 29 : 28) :
+           (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+}
+//Howard Hinnant's days_from_civil / civil_from_days, years start in March
+//so the leap day is the last day of the year
+constexpr DayNumber daysFromCivil(int year, int month, int day) {
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yearOfEra = y - era * 400;
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+constexpr CivilDate civilFromDays(DayNumber date) {
+    int z = date + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int dayOfEra = z - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int mp = (5 * dayOfYear + 2) / 153;
+    int month = mp < 10 ? mp + 3 : mp - 9;
+    return CivilDate{yearOfEra + era * 400 + (month <= 2 ? 1 : 0), month, dayOfYear - (153 * mp + 2) / 5 + 1};
+}
+const DayNumber APP_START_DATE = daysFromCivil(2025, 12, 20);
+
 struct Weather 
 {
-    string city;
+    int cityId;            // index into CITIES
     int type;              // 0=normal, 1=rain, 2=festival
     float priceMultiplier; // multiplier applied to hotel prices
 };
 
-struct Hotel {
-    string name;
-    string city;
-    string category;
-    float basePrice;
-    float currentPrice;
-    float rating;
-    bool hasWifi;
-    bool hasPool;
-    bool isActive;
-    bool hasDeal;
-    float dealPercent;
+//Hotel flag bits
+const unsigned char HOTEL_WIFI = 1;
+const unsigned char HOTEL_POOL = 2;
+const unsigned char HOTEL_ACTIVE = 4;
+const unsigned char HOTEL_DEAL = 8;
+
+//Hotel catalog stored column by column, one entry per hotel in every array.
+//City and category are small IDs into CITIES / CATEGORIES so filters and
+//pricing compare integers and only read the columns they need.
+//The static columns point straight into the mapped catalog file, or into
+//the own* vectors when hotels come from the built-in list / addHotel.
+struct HotelCatalog {
+    const float* basePrice;
+    const float* rating;
+    const unsigned char* cityId;
+    const unsigned char* categoryId;
+    const unsigned short* roomCount;
+    const unsigned int* nameOffset;  // hotelCount + 1 entries into nameData
+    const char* nameData;
+    //Live columns, change while the app runs
+    vector<float> currentPrice;
+    vector<float> dealPercent;
+    vector<DayNumber> dealEndDay;  // first day without the deal
+    vector<unsigned char> flags;
+    //Owned storage for the static columns when not using the mapped file
+    vector<float> ownBasePrice;
+    vector<float> ownRating;
+    vector<unsigned char> ownCityId;
+    vector<unsigned char> ownCategoryId;
+    vector<unsigned short> ownRoomCount;
+    vector<unsigned int> ownNameOffset;
+    string ownNameData;
+};
+
+//Save files: a snapshot of the traveler and a journal of the changes since
+const char SAVE_FILE[] = "musafir_save.bin";
+const char TEXT_SAVE_FILE[] = "musafir_save.txt";  // older text snapshot, read if there is no binary one
+const char JOURNAL_FILE[] = "musafir_journal.txt";
+//Binary snapshot, all values little-endian. Strings are stored once in a
+//string table and referred to by index.
+const unsigned int SAVE_MAGIC = 0x5653554D;  // "MUSV"
+const unsigned int SAVE_VERSION = 1;
+const unsigned int SAVE_BUDGET_MODE = 1;
+const unsigned int SAVE_PLANNER = 2;
+const unsigned int SAVE_FREQUENT_TRAVELER = 4;
+const unsigned int SAVE_BUDGET_MASTER = 8;
+const unsigned int SAVE_EXPLORER = 16;
+struct SaveFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int headerBytes;       // later versions may add fields at the end
+    unsigned int fileSize;
+    unsigned int headerChecksum;    // hashBytes of the header with this field zero
+    unsigned int dataChecksum;      // hashBytes of everything after the header
+    unsigned long long journalSeq;  // last journal record in this snapshot
+    unsigned long long lastBookingId;
+    unsigned int bookingCount;
+    unsigned int bookingOffset;     // SavedBooking[bookingCount]
+    unsigned int noteCount;
+    unsigned int noteOffset;        // string index[noteCount]
+    unsigned int visitedCount;
+    unsigned int visitedOffset;     // string index[visitedCount * 2], name then city
+    unsigned int stringCount;
+    unsigned int stringOffsetOffset;  // unsigned int[stringCount + 1]
+    unsigned int stringBytes;
+    unsigned int stringDataOffset;  // char[stringBytes]
+    unsigned int nameString;
+    unsigned int flags;             // SAVE_BUDGET_MODE, SAVE_PLANNER and badge bits
+    int totalBookings;
+    float totalSpent;
+    int placesVisited;
+    float maxBudget;
+    int level;
+    int destinationsTravelled;
+    float plannerBudget;
+    int plannedTrips;
+    float spentInPlan;
+    int tripsInPlan;
+};
+struct SavedBooking {
+    unsigned long long bookingId;
+    unsigned int hotelName;  // string index
+    unsigned int city;       // string index
+    int checkIn;
+    int nights;
+    int guests;
+    int rooms;
+    float totalCost;
+    unsigned int unused;
+};
+//Binary catalog file, all values little-endian, columns aligned to 4 bytes
+const char CATALOG_FILE[] = "musafir_hotels.bin";
+const unsigned int CATALOG_MAGIC = 0x4C54484D;  // "MHTL"
+const unsigned int CATALOG_VERSION = 2;
+struct CatalogFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int hotelCount;
+    unsigned int nameBytes;
+    unsigned int basePriceOffset;   // float[hotelCount]
+    unsigned int ratingOffset;      // float[hotelCount]
+    unsigned int nameOffsetOffset;  // unsigned int[hotelCount + 1]
+    unsigned int cityIdOffset;      // unsigned char[hotelCount]
+    unsigned int categoryIdOffset;  // unsigned char[hotelCount]
+    unsigned int amenityOffset;     // unsigned char[hotelCount], HOTEL_WIFI / HOTEL_POOL bits
+    unsigned int nameDataOffset;    // char[nameBytes]
+    unsigned int fileSize;
+    unsigned int roomCountOffset;   // unsigned short[hotelCount], version 2 and later
+};
+//Read-only file mapping
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+    bool isMapped;  // false when the data was read into a heap buffer
 };
+//64-bit booking ID: milliseconds since BOOKING_ID_EPOCH_MS, then the shard
+//that issued it, then a sequence number within that millisecond
+typedef unsigned long long BookingId;
 struct Booking {
     string hotelName;
     string city;
-    string bookingId;
+    BookingId bookingId;
     int nights;
     int guests;
     float totalCost;
     bool isActive;
-    string checkInDate;
-    string checkOutDate;
+    DayNumber checkIn;
+    DayNumber checkOut;  // checkIn + nights
     int rooms;
+    int hotelId;  // catalog index of the hotel, -1 if it is no longer listed
 };
 
 struct UserProfile {
     string name;
     int totalBookings;
-    float totalSpent;
+    atomic<float> totalSpent;  // changed through addSpent only
     float maxBudget;
     bool budgetMode;
     int placesVisited;
     float travelerScore;
     int level;
-    string preferredCities[MAX_PREFERRED_CITIES];
+    int preferredCities[MAX_PREFERRED_CITIES]; // city IDs
     int preferredCityCount;
 };
 //Budget planner settings
@@ -115,27 +294,418 @@ enum Screen {
 };
 
 
+//Trigram index over lowercased hotel names. Each posting list holds the
+//sorted IDs of active hotels whose name contains that 3 letter sequence.
+struct NameIndex {
+    bool built;
+    string lowerNames;  // same offsets as HotelCatalog::nameOffset
+    unordered_map<unsigned int, vector<int>> postings;
+};
+
+//One memoized search, valid while the catalog's price epoch is unchanged
+struct SearchCacheEntry {
+    bool valid;
+    string name;
+    string city;
+    string category;
+    float minPrice;
+    float maxPrice;
+    unsigned char requiredFlags;
+    bool budgetMode;
+    unsigned int epoch;
+    unsigned int lastUsed;
+    unsigned int generation;  // changes every time the entry is refilled
+    vector<int> results;
+};
+const int SEARCH_CACHE_SIZE = 8;
+//Search-as-you-type history. Each step's query narrows the step below it,
+//so its results are a subset of the results below it.
+struct RefineStep {
+    string name;  // lowercased
+    string city;
+    string category;
+    float minPrice;
+    float maxPrice;
+    unsigned char requiredFlags;
+    bool budgetMode;
+    unsigned int epoch;
+    vector<int> results;
+};
+const int MAX_REFINE_STEPS = 64;
+//Queries are grouped by which of city / category they filter on, each
+//group keeps its own typing history so interleaved queries don't pop
+//each other's steps
+const int REFINE_SHAPES = 4;
+
+//Active hotels ordered by effective price (currentPrice * mode multiplier),
+//ties broken by hotel ID. One index per travel mode.
+struct PriceIndex {
+    vector<int> hotelIds;
+    vector<float> prices;  // effective price of each entry, same order
+};
+
+//Bitset over hotel IDs, 64 hotels per word
+struct HotelBitmap {
+    vector<unsigned long long> words;
+};
+//One bitmap per facet value. Every facet here is low-cardinality and dense
+//(the rarest, deals, covers about 1 hotel in 5), so plain word bitmaps are
+//what a Roaring container would pick for them anyway.
+struct FacetBitmaps {
+    HotelBitmap active;
+    HotelBitmap city[MAX_CITIES];
+    HotelBitmap category[MAX_CATEGORIES];
+    HotelBitmap wifi;
+    HotelBitmap pool;
+    HotelBitmap deal;
+};
+//Result counts per facet value for one query. City and category counts
+//ignore the query's own city / category filter.
+struct FacetCounts {
+    bool valid;
+    string name;
+    string city;
+    string category;
+    float minPrice;
+    float maxPrice;
+    bool budgetMode;
+    unsigned char requiredFlags;
+    unsigned int epoch;
+    int cityCount[MAX_CITIES];
+    int categoryCount[MAX_CATEGORIES];
+    int wifiCount;
+    int poolCount;
+    int dealCount;
+};
+
+//Orders for ranked result pages
+enum RankKey {
+    RANK_CATALOG,  // catalog order
+    RANK_PRICE,    // cheapest effective price first
+    RANK_RATING,   // best rated first
+    RANK_DEAL,     // biggest deal first
+    RANK_SCORE     // weighted rating / deal / price score
+};
+const int RANK_KEY_COUNT = 5;
+const string RANK_KEY_NAMES[RANK_KEY_COUNT] = {"Default", "Price", "Rating", "Deal", "Score"};
+//Position in a ranked result list, only meaningful to the paging functions
+struct SearchCursor {
+    bool started;    // false = before the first result
+    float rankValue;
+    int hotelIndex;
+};
+//One page of a ranked result list, memoized until the page inputs change
+const int MAX_PAGE_SIZE = 16;
+struct SearchPage {
+    bool valid;
+    unsigned int generation;
+    unsigned int epoch;
+    int rankKey;
+    int pageSize;
+    SearchCursor start;
+    int count;
+    int hotelIds[MAX_PAGE_SIZE];
+    SearchCursor cursors[MAX_PAGE_SIZE];  // cursor just after each hotel
+};
+
+//Contiguous block of hotel IDs that share a city, so a city can be
+//repriced with the same kernel as the whole catalog
+struct CityRun {
+    int first;
+    int count;
+};
+
 // Global arrays
-Hotel hotels[MAX_HOTELS];
+HotelCatalog hotels;
 int hotelCount = 0;
+MappedFile catalogFile = {nullptr, 0, false};
+NameIndex nameIndex;
+PriceIndex priceIndex[2];  // [0] = luxury mode, [1] = budget mode
+bool priceIndexBuilt = false;
+FacetBitmaps facets;
+HotelBitmap queryBitmap;  // scratch bitmap reused by each search
+vector<CityRun> cityRuns[MAX_CITIES];
+FacetCounts facetCounts;
+//Bumped whenever prices or the set of hotels change, invalidates cached searches
+unsigned int priceEpoch = 0;
+SearchCacheEntry searchCache[SEARCH_CACHE_SIZE];
+unsigned int searchCacheClock = 0;
+int searchCacheHits = 0;
+int searchCacheMisses = 0;
+vector<RefineStep> refineStacks[REFINE_SHAPES];
+int refinedSearches = 0;  // misses answered from the previous result set
+unsigned int searchGenerationCounter = 0;
+SearchPage resultPage;
+//Scroll state of the visible result list: cursor before the first visible
+//hotel, plus the earlier cursors so "Up" can step back
+SearchCursor pageStart = {false, 0, -1};
+vector<SearchCursor> pageHistory;
 
 Weather weatherData[MAX_WEATHER];
 int weatherCount = 0;
+//Forecast weather per city for PRICE_CALENDAR_DAYS days from today, kept
+//in rings indexed by day number so moving on a day only writes one entry.
+//Running sums of the price multiplier let a stay be quoted without walking
+//its nights.
+const int PRICE_CALENDAR_DAYS = 365;
+const float MIN_WEATHER_MULTIPLIER = 0.85f;
+const float MAX_WEATHER_MULTIPLIER = 1.15f;
+struct PriceCalendar {
+    DayNumber firstDay;                             // today
+    vector<unsigned char> weatherType[MAX_CITIES];  // day d at d % PRICE_CALENDAR_DAYS
+    vector<double> multiplierSum[MAX_CITIES];       // sum of the days before d at d % (PRICE_CALENDAR_DAYS + 1)
+};
+PriceCalendar priceCalendar;
 
-Booking bookings[MAX_BOOKINGS];
-int bookingCount = 0;
+//Event scheduler: a hierarchical timing wheel keyed on day. Level 0 has a
+//slot per day of the current 64-day block, level 1 a slot per 64-day block
+//and level 2 a slot per 4096-day block, anything later waits in overflow.
+//Events drop down a level when their block comes up.
+enum EventType {
+    EVENT_CHECKOUT,  // target = booking index
+    EVENT_DEAL_END,  // target = hotel index
+    EVENT_WEATHER    // target = city id, its forecast multiplier changes that day
+};
+struct ScheduledEvent {
+    DayNumber day;
+    int type;
+    int target;
+};
+const int WHEEL_BITS = 6;
+const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+const int WHEEL_LEVELS = 3;
+struct TimingWheel {
+    DayNumber now;
+    vector<ScheduledEvent> slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    vector<ScheduledEvent> overflow;
+};
+TimingWheel timingWheel;
+//Events that came due and are not handled yet. The main loop only does
+//time-based work while this is non-empty.
+vector<ScheduledEvent> dueEvents;
+//Booking calls schedule checkouts from any thread, so the wheel and
+//dueEvents are only touched under scheduleMutex
+mutex scheduleMutex;
+
+//Booking store. Bookings live in fixed-size chunks that never move, so a
+//slot number stays valid while the store grows. Cancelled bookings put
+//their slot on a free list and completed ones move to bookingHistory, so
+//only live bookings are ever walked. A slot's generation changes when it is
+//freed, so a handle to a booking that is gone stops resolving.
+const int BOOKING_CHUNK_BITS = 6;
+const int BOOKING_CHUNK_SIZE = 1 << BOOKING_CHUNK_BITS;
+struct BookingSlot {
+    Booking booking;
+    unsigned int generation;
+    int nextFree;  // next slot on the free list, -1 at the end
+    bool claimed;  // an edit or cancel is moving its rooms
+};
+struct BookingStore {
+    vector<unique_ptr<BookingSlot[]>> chunks;
+    int slotCount;     // slots created so far
+    int freeHead;      // first free slot, -1 if none
+    vector<int> live;  // slots in use, oldest booking first
+};
+struct BookingHandle {
+    int slot;
+    unsigned int generation;
+};
+BookingStore bookingStore = {vector<unique_ptr<BookingSlot[]>>(), 0, -1, vector<int>()};
+vector<Booking> bookingHistory;  // completed trips, oldest first
+const BookingId BOOKING_ID_EPOCH_MS = 1735689600000ULL;  // 01-01-2025 UTC
+const int BOOKING_SEQUENCE_BITS = 12;
+const int BOOKING_SHARD_BITS = 10;
+const int BOOKING_TIME_SHIFT = BOOKING_SEQUENCE_BITS + BOOKING_SHARD_BITS;
+const BookingId BOOKING_SEQUENCE_MASK = (1ULL << BOOKING_SEQUENCE_BITS) - 1;
+unsigned int bookingShard = 0;  // 0..1023, one per process issuing IDs
+//Last ID handed out, saved with the game so IDs keep rising across restarts
+//even if the clock steps back
+atomic<BookingId> lastBookingId(0);
+//Open-addressing hash index from a key to an array position. Each slot keeps
+//the key's hash next to the position, so probes skip most key compares and
+//growing never has to look at the keys again.
+const int HASH_EMPTY = -1;
+const int HASH_DELETED = -2;
+struct HashIndex {
+    vector<int> values;           // position, HASH_EMPTY or HASH_DELETED
+    vector<unsigned int> hashes;
+    int used;                     // slots that are not HASH_EMPTY
+};
+HashIndex hotelKeyIndex;   // (name, city) -> hotel
+HashIndex bookingIdIndex;  // booking ID -> booking
+HashIndex visitedIndex;    // (name, city) -> visited entry
+vector<int> hotelActiveBookings;  // active bookings per hotel
+//Stays of the active bookings ordered by check-in day. A stay that overlaps
+//[s, e) starts before e and after s - longestStay, so a query walks that
+//window: O(log n) to find it, then every stay starting inside it, overlapping
+//or not. Stays are short (booking allows up to 30 nights) so the window is
+//too, but a longer stay read from an old save widens it for every query.
+struct StayIndex {
+    multimap<int, int> byCheckIn;  // check-in day -> booking index
+    multiset<int> lengths;         // nights of every indexed stay
+};
+StayIndex stayIndex;
+//Room inventory. Each hotel keeps its own rooms booked per night, guarded
+//by the hotel's lock stripe, so bookings at different hotels do not wait on
+//each other. Each night also keeps bitmaps of the hotels with rooms booked
+//and with no rooms left, so availability over a date range is a few
+//word-wide passes; those take inventoryMutex.
+const int HOTEL_LOCK_STRIPES = 64;
+mutex hotelLocks[HOTEL_LOCK_STRIPES];
+mutex inventoryMutex;
+struct NightInventory {
+    HotelBitmap booked;   // hotels with any room booked that night
+    HotelBitmap soldOut;  // hotels with no room left that night
+    int hotelsBooked;     // bits set in booked
+};
+vector<map<DayNumber, int>> hotelNights;  // hotel -> night -> rooms booked
+map<DayNumber, NightInventory> roomInventory;
+atomic<unsigned int> inventoryEpoch(0);  // bumped whenever a reservation changes
+//Booking engine lock. createBooking, updateBooking and cancelBooking may run
+//on many threads at once: each holds dayLock shared, reserves the budget
+//with a compare-and-swap, moves rooms under the hotel's stripe alone and
+//then takes accountMutex briefly for the booking store, its indexes and
+//the planner. The two locks are never held together. The day tick
+//(advanceDay, runDueEvents) and Reset All hold dayLock exclusively, so
+//appDate, prices and checkouts never change under a booking call. Loading
+//and catalog changes stay on the main thread and run while no booking call
+//is in flight.
+//New shared holders wait at the gate while a tick is waiting for the lock,
+//so a steady stream of booking calls cannot starve the day tick.
+struct DayLock {
+    mutex gate;
+    shared_timed_mutex state;
+    void lock() {
+        lock_guard<mutex> waiting(gate);
+        state.lock();
+    }
+    void unlock() { state.unlock(); }
+    void lock_shared() {
+        { lock_guard<mutex> waiting(gate); }
+        state.lock_shared();
+    }
+    void unlock_shared() { state.unlock_shared(); }
+};
+DayLock dayLock;
+mutex accountMutex;
+//Write-ahead journal. Each change appends one numbered record; a commit
+//writes every pending record with a single fsync, so callers that commit at
+//the same time share it. Once the file holds JOURNAL_COMPACT_RECORDS records
+//the main loop folds it into a new snapshot.
+const int JOURNAL_COMPACT_RECORDS = 256;
+struct Journal {
+    mutex lock;                     // pending, lastSeq and records
+    mutex flushLock;                // one writer of the file at a time
+    string pending;                 // records not written yet
+    unsigned long long lastSeq;     // number of the last record appended
+    unsigned long long durableSeq;  // number of the last record synced
+    int records;                    // records in the file
+    atomic<bool> compactWanted;
+    string lastSettings;            // last SETTINGS / NOTES records, main thread only
+    string lastNotes;
+};
+Journal journal;
+//Persistence worker. Journal commits and snapshot writes run on one
+//background thread, so a frame never waits on the disk. Snapshots are
+//encoded on the main thread and handed over as they are.
+struct PersistenceWorker {
+    thread worker;
+    mutex lock;                  // everything below
+    condition_variable wake;     // work queued or stopping
+    condition_variable idle;     // all queued work done
+    bool running;
+    bool stopping;
+    bool busy;
+    bool commitWanted;
+    bool snapshotWanted;
+    string snapshotData;         // newest snapshot waiting to be written
+    unsigned long long snapshotSeq;
+    bool failed;                 // last write failed
+    string error;
+    string lastSnapshot;         // last snapshot queued, cleared if it failed
+    map<string, string> profileWrites;  // parked profiles by user key, newest only
+};
+PersistenceWorker persistence;
+//Save coordinator. Every change is numbered by the journal, so the journal
+//sequence is the state's generation. Commits asked for within window
+//seconds of the first unsaved one go out as a single write.
+const double SAVE_WINDOW_SECONDS = 0.5;
+struct SaveCoordinator {
+    double window;
+    bool waiting;                           // a commit was asked for
+    double firstRequest;                    // when the oldest waiting request was seen, -1 if not yet
+    atomic<unsigned long long> requested;   // commits and snapshots asked for
+    atomic<unsigned long long> performed;   // journal and snapshot writes done
+};
+SaveCoordinator saves = {SAVE_WINDOW_SECONDS, false, -1, {0}, {0}};
+mutex& hotelLock(int hotelIndex) {
+    return hotelLocks[hotelIndex & (HOTEL_LOCK_STRIPES - 1)];
+}
 Font appFont;
+//Text cache. Widths are kept per (text, size), so each string is measured
+//once. A string drawn with the same size and color on TEXT_STABLE_FRAMES
+//frames is rasterized into an atlas texture and drawn as one quad after
+//that; text that changes every frame keeps going through DrawTextEx.
+const int TEXT_ATLAS_SIZE = 2048;
+const int TEXT_STABLE_FRAMES = 2;
+const int TEXT_CACHE_LIMIT = 4096;  // past this the least recently used half is dropped
+struct TextImage {
+    Color color;
+    unsigned int lastFrame;  // last frame it was drawn on
+    int frames;              // frames it was drawn on
+    bool queued;             // waiting to be rasterized
+    Rectangle rect;          // place in the atlas, width 0 if not in it
+};
+struct TextEntry {
+    string text;
+    int size;
+    int width;                 // -1 until it is measured
+    int height;                // more than size for text with line breaks
+    unsigned int lastUsed;     // last frame it was drawn or measured on
+    vector<TextImage> images;  // one per color
+};
+struct TextCache {
+    HashIndex index;         // hash of (text, size) -> entries
+    vector<TextEntry> entries;
+    vector<pair<int, int>> queued;  // entry, image
+    RenderTexture2D atlas;
+    int shelfX;              // next free spot on the current shelf
+    int shelfY;
+    int shelfHeight;
+    bool wipeAtlas;          // clear the atlas before drawing to it again
+    unsigned int frame;
+};
+TextCache textCache;
 UserProfile user;
 BudgetPlanner planner;
+//User table. The globals (user, planner, notes, badges, visited hotels and
+//bookings) hold the traveler being served. Everyone else waits here as the
+//binary encoding of their save file, one string per traveler, or stays on
+//disk until first asked for. Travelers are keyed by their lowercased name,
+//which also names their profile file; its hash only picks the shard, each
+//with its own lock. A traveler's stays keep their rooms while they are parked.
+const int PROFILE_SHARDS = 16;
+const char* PROFILE_DIR = "profiles";
+struct ProfileEntry {
+    string state;    // encodeSave bytes, empty until their file is rewritten
+    bool roomsHeld;  // this traveler's stays are counted in the room inventory
+};
+struct ProfileShard {
+    mutex lock;
+    unordered_map<string, ProfileEntry> profiles;
+};
+ProfileShard profileShards[PROFILE_SHARDS];
+string currentUserKey;
 
 Achievements badges;
 int destinationsTravelled = 0;
 
 
 Screen currentScreen = SCREEN_SPLASH;
+bool quitRequested = false;  // Save & Quit, the main loop ends after this frame
 int selectedHotelIndex = -1;
 
-int selectedBookingIndex = -1;
+BookingHandle selectedBooking = {-1, 0};
 int scrollPosition = 0;
 float splashTimer = 0;
 string inputText = "";
@@ -146,17 +716,16 @@ string searchCity = "";
 string searchCategory = "";
 float searchMinPrice = 0;
 float searchMaxPrice = 50000;
+unsigned char searchAmenities = 0;  // HOTEL_WIFI / HOTEL_POOL / HOTEL_DEAL bits the results must have
+int searchSortKey = RANK_CATALOG;
+unsigned int searchPageGeneration = 0;
 int inputFieldActive = 0;
 //Booking form variables
 int nights = 1;
 int guests = 2;
-int bookingDay = 20;
-int bookingMonth = 12;
-int bookingYear = 2025;
+DayNumber bookingDate = APP_START_DATE;
 //App's current date (simulated)
-int appDay = 20;
-int appMonth = 12;
-int appYear = 2025;
+DayNumber appDate = APP_START_DATE;
 float dateTimer = 0;
 // Saved recommendations (to prevent flickering)
 int savedHotels[3] = {-1, -1, -1};
@@ -166,9 +735,7 @@ int lastPrefCities = -1;
 //Edit booking variables
 int editNights = 1;
 int editGuests = 2;
-int editDay = 20;
-int editMonth = 12;
-int editYear = 2025;
+DayNumber editDate = APP_START_DATE;
 //Array to track visited hotel names
 const int MAX_VISITED_HOTELS = 100;
 string visitedHotelNames[MAX_VISITED_HOTELS];
@@ -184,14 +751,174 @@ float clamp(float value, float minVal, float maxVal) {
 string formatMoney(float amount){
     return "Rs." + to_string((int)amount);
 }
-string formatDate(int day, int month, int year) {
-    string d = (day < 10) ? "0" + to_string(day) : to_string(day);
-    string m = (month < 10) ? "0" + to_string(month) : to_string(month);
-    return d + "-" + m + "-" + to_string(year);
+string formatDate(DayNumber date) {
+    CivilDate c = civilFromDays(date);
+    string d = (c.day < 10) ? "0" + to_string(c.day) : to_string(c.day);
+    string m = (c.month < 10) ? "0" + to_string(c.month) : to_string(c.month);
+    return d + "-" + m + "-" + to_string(c.year);
+}
+//FNV-1a, pass the previous hash to chain several fields
+unsigned int hashBytes(const char* data, size_t length, unsigned int hash = 2166136261u) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+unsigned int hashString(const string& text, unsigned int hash = 2166136261u) {
+    return hashBytes(text.data(), text.length(), hash);
+}
+void hashClear(HashIndex& index) {
+    index.values.assign(16, HASH_EMPTY);
+    index.hashes.assign(16, 0);
+    index.used = 0;
+}
+void hashRehash(HashIndex& index, int size) {
+    vector<int> values;
+    vector<unsigned int> hashes;
+    values.swap(index.values);
+    hashes.swap(index.hashes);
+    index.values.assign(size, HASH_EMPTY);
+    index.hashes.assign(size, 0);
+    index.used = 0;
+    for (int s = 0; s < (int)values.size(); s++) {
+        if (values[s] < 0) continue;
+        int slot = hashes[s] & (size - 1);
+        while (index.values[slot] != HASH_EMPTY) slot = (slot + 1) & (size - 1);
+        index.values[slot] = values[s];
+        index.hashes[slot] = hashes[s];
+        index.used++;
+    }
+}
+void hashInsert(HashIndex& index, unsigned int hash, int value) {
+    if (index.values.empty()) hashClear(index);
+    int size = (int)index.values.size();
+    //Keep a quarter of the slots empty so every probe ends quickly. Deleted
+    //slots count as used until a rehash drops them, and the table only
+    //grows if it would still be over half full.
+    if ((index.used + 1) * 4 > size * 3) {
+        int live = 0;
+        for (int s = 0; s < size; s++) {
+            if (index.values[s] >= 0) live++;
+        }
+        while ((live + 1) * 2 > size) size *= 2;
+        hashRehash(index, size);
+    }
+    int slot = hash & (size - 1);
+    while (index.values[slot] >= 0) slot = (slot + 1) & (size - 1);
+    if (index.values[slot] == HASH_EMPTY) index.used++;
+    index.values[slot] = value;
+    index.hashes[slot] = hash;
+}
+//Next position stored under this hash, start with slot = -1. Returns -1 when
+//there are no more, the caller checks the key of each one.
+int hashNext(const HashIndex& index, unsigned int hash, int& slot) {
+    if (index.values.empty()) return -1;
+    int mask = (int)index.values.size() - 1;
+    int s = (slot == -1) ? (int)(hash & mask) : ((slot + 1) & mask);
+    while (index.values[s] != HASH_EMPTY) {
+        if (index.values[s] >= 0 && index.hashes[s] == hash) {
+            slot = s;
+            return index.values[s];
+        }
+        s = (s + 1) & mask;
+    }
+    return -1;
+}
+void hashErase(HashIndex& index, unsigned int hash, int value) {
+    int slot = -1;
+    for (int v = hashNext(index, hash, slot); v != -1; v = hashNext(index, hash, slot)) {
+        if (v == value) {
+            index.values[slot] = HASH_DELETED;
+            return;
+        }
+    }
+}
+
+BookingSlot& bookingSlot(int slot) {
+    return bookingStore.chunks[slot >> BOOKING_CHUNK_BITS][slot & (BOOKING_CHUNK_SIZE - 1)];
+}
+Booking& bookingAt(int slot) {
+    return bookingSlot(slot).booking;
+}
+bool isLiveBooking(int slot) {
+    return slot >= 0 && slot < bookingStore.slotCount && bookingAt(slot).isActive;
+}
+BookingHandle bookingHandle(int slot) {
+    BookingHandle handle = {slot, bookingSlot(slot).generation};
+    return handle;
+}
+//NULL once the booking was cancelled or completed
+Booking* findBooking(BookingHandle handle) {
+    if (!isLiveBooking(handle.slot)) return NULL;
+    BookingSlot& s = bookingSlot(handle.slot);
+    return s.generation == handle.generation ? &s.booking : NULL;
+}
+//Slot for a new booking, a freed one first, otherwise a new chunk as needed
+int allocBookingSlot() {
+    int slot = bookingStore.freeHead;
+    if (slot != -1) {
+        bookingStore.freeHead = bookingSlot(slot).nextFree;
+    } else {
+        if (bookingStore.slotCount % BOOKING_CHUNK_SIZE == 0) {
+            bookingStore.chunks.push_back(unique_ptr<BookingSlot[]>(new BookingSlot[BOOKING_CHUNK_SIZE]()));
+        }
+        slot = bookingStore.slotCount++;
+    }
+    bookingSlot(slot).claimed = false;
+    bookingStore.live.push_back(slot);
+    return slot;
+}
+void freeBookingSlot(int slot) {
+    BookingSlot& s = bookingSlot(slot);
+    s.booking.isActive = false;
+    s.generation++;
+    s.nextFree = bookingStore.freeHead;
+    bookingStore.freeHead = slot;
+    vector<int>& live = bookingStore.live;
+    live.erase(find(live.begin(), live.end(), slot));
 }
-string generateBookingId() {
-    int num = 1000 + rand() % 9000;
-    return to_string(num);
+void clearBookings() {
+    bookingStore.chunks.clear();
+    bookingStore.slotCount = 0;
+    bookingStore.freeHead = -1;
+    bookingStore.live.clear();
+    bookingHistory.clear();
+}
+
+unsigned int bookingIdHash(BookingId bookingId) {
+    return hashBytes((const char*)&bookingId, sizeof(bookingId));
+}
+int findBookingById(BookingId bookingId) {
+    unsigned int hash = bookingIdHash(bookingId);
+    int slot = -1;
+    for (int i = hashNext(bookingIdIndex, hash, slot); i != -1; i = hashNext(bookingIdIndex, hash, slot)) {
+        if (bookingAt(i).bookingId == bookingId) return i;
+    }
+    return -1;
+}
+//Lock-free: callers race on one compare-and-swap of the last ID. The next ID
+//is this millisecond's first one, or the one after the last if that is not
+//smaller. A full sequence moves on to the next millisecond.
+BookingId generateBookingId() {
+    using namespace std::chrono;
+    BookingId now = (BookingId)duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    BookingId shardBits = (BookingId)(bookingShard & ((1u << BOOKING_SHARD_BITS) - 1)) << BOOKING_SEQUENCE_BITS;
+    BookingId candidate = ((now - BOOKING_ID_EPOCH_MS) << BOOKING_TIME_SHIFT) | shardBits;
+    BookingId last = lastBookingId.load();
+    BookingId next;
+    do {
+        if (candidate > last) next = candidate;
+        else if ((last & BOOKING_SEQUENCE_MASK) != BOOKING_SEQUENCE_MASK) next = last + 1;
+        else next = (((last >> BOOKING_TIME_SHIFT) + 1) << BOOKING_TIME_SHIFT) | shardBits;
+    } while (!lastBookingId.compare_exchange_weak(last, next));
+    return next;
+}
+//Never move the last ID back, a loaded save may be older than this run
+void noteBookingId(BookingId bookingId) {
+    BookingId last = lastBookingId.load();
+    while (bookingId > last && !lastBookingId.compare_exchange_weak(last, bookingId)) {
+    }
 }
 
 bool containsIgnoreCase(string text, string search) 
@@ -215,121 +942,215 @@ bool containsIgnoreCase(string text, string search)
     return position != (int)string::npos;
 }
 
-// Parse a date string "DD-MM-YYYY" into day, month, year
-void parseDate(string dateStr, int& day, int& month, int& year) {
+// Parse a date string "DD-MM-YYYY", only used when loading the save file
+DayNumber parseDate(const string& dateStr) {
     int dash1 = dateStr.find('-');
     int dash2 = dateStr.find('-', dash1 + 1);
-    day = stoi(dateStr.substr(0, dash1));
-    month = stoi(dateStr.substr(dash1 + 1, dash2 - dash1 - 1));
-    year = stoi(dateStr.substr(dash2 + 1));
+    int day = stoi(dateStr.substr(0, dash1));
+    int month = stoi(dateStr.substr(dash1 + 1, dash2 - dash1 - 1));
+    int year = stoi(dateStr.substr(dash2 + 1));
+    return daysFromCivil(year, month, day);
+}
+int daysFromToday(DayNumber date) {
+    return date - appDate;
+}
+bool isDateInPast(DayNumber date) {
+    return date < appDate;
+}
+//Day / month buttons of the date pickers, the day is kept inside the month
+DayNumber stepDay(DayNumber date, int delta) {
+    CivilDate c = civilFromDays(date);
+    c.day = max(1, min(c.day + delta, daysInMonth(c.year, c.month)));
+    return daysFromCivil(c.year, c.month, c.day);
+}
+DayNumber stepMonth(DayNumber date, int delta) {
+    CivilDate c = civilFromDays(date);
+    c.month = max(1, min(c.month + delta, 12));
+    c.day = min(c.day, daysInMonth(c.year, c.month));
+    return daysFromCivil(c.year, c.month, c.day);
 }
 
-void calculateCheckoutDate(int startDay, int startMonth, int startYear, int numNights,
-                           int& outDay, int& outMonth, int& outYear) {
-    outDay = startDay + numNights;
-    outMonth = startMonth;
-    outYear = startYear;
-while (outDay > 30) {
-        outDay -= 30;
-        outMonth++;
-        if (outMonth > 12) {
-            outMonth = 1;
-            outYear++;
+void wheelInsert(const ScheduledEvent& event) {
+    //Lowest level whose current block holds the day
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int blockShift = WHEEL_BITS * (level + 1);
+        if ((event.day >> blockShift) == (timingWheel.now >> blockShift)) {
+            timingWheel.slots[level][(event.day >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)].push_back(event);
+            return;
         }
     }
+    timingWheel.overflow.push_back(event);
 }
-bool isDateInPast(int day, int month, int year) {
-    if (year < appYear) return true;
-    if (year > appYear) return false;
-    if (month < appMonth) return true;
-    if (month > appMonth) return false;
-    return day < appDay;
+//Events for today or earlier are due straight away
+void scheduleEvent(DayNumber day, int type, int target) {
+    lock_guard<mutex> lock(scheduleMutex);
+    ScheduledEvent event = {day, type, target};
+    if (day <= timingWheel.now) dueEvents.push_back(event);
+    else wheelInsert(event);
+}
+void resetTimingWheel(DayNumber now) {
+    lock_guard<mutex> lock(scheduleMutex);
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) timingWheel.slots[level][slot].clear();
+    }
+    timingWheel.overflow.clear();
+    timingWheel.now = now;
+    dueEvents.clear();
+}
+void reinsertEvents(vector<ScheduledEvent>& events) {
+    vector<ScheduledEvent> moving;
+    moving.swap(events);
+    for (int k = 0; k < (int)moving.size(); k++) wheelInsert(moving[k]);
+}
+//Move the wheel on one day and queue that day's events in dueEvents
+void advanceTimingWheel() {
+    lock_guard<mutex> lock(scheduleMutex);
+    DayNumber now = ++timingWheel.now;
+    //Higher levels first so an event can drop more than one level at once
+    if ((now & ((1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)) == 0) reinsertEvents(timingWheel.overflow);
+    for (int level = WHEEL_LEVELS - 1; level >= 1; level--) {
+        if ((now & ((1 << (WHEEL_BITS * level)) - 1)) != 0) continue;
+        reinsertEvents(timingWheel.slots[level][(now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)]);
+    }
+    vector<ScheduledEvent>& today = timingWheel.slots[0][now & (WHEEL_SLOTS - 1)];
+    dueEvents.insert(dueEvents.end(), today.begin(), today.end());
+    today.clear();
+}
+bool hasDueEvents() {
+    lock_guard<mutex> lock(scheduleMutex);
+    return !dueEvents.empty();
 }
 
-bool isHotelVisited(string hotelName, string city) {
-    for (int i = 0; i < visitedHotelCount; i++) {
-        if (visitedHotelNames[i] == hotelName && visitedHotelCities[i] == city) {
-            return true;
-        }
+unsigned int visitedHash(const string& hotelName, const string& city) {
+    return hashString(city, hashString(hotelName));
+}
+bool isHotelVisited(const string& hotelName, const string& city) {
+    unsigned int hash = visitedHash(hotelName, city);
+    int slot = -1;
+    for (int i = hashNext(visitedIndex, hash, slot); i != -1; i = hashNext(visitedIndex, hash, slot)) {
+        if (visitedHotelNames[i] == hotelName && visitedHotelCities[i] == city) return true;
     }
     return false;
 }
+void buildVisitedIndex() {
+    hashClear(visitedIndex);
+    for (int i = 0; i < visitedHotelCount; i++) {
+        hashInsert(visitedIndex, visitedHash(visitedHotelNames[i], visitedHotelCities[i]), i);
+    }
+}
 
-void markHotelVisited(string hotelName, string city) {
+void markHotelVisited(const string& hotelName, const string& city) {
     if (!isHotelVisited(hotelName, city) && visitedHotelCount < MAX_VISITED_HOTELS) {
         visitedHotelNames[visitedHotelCount] = hotelName;
         visitedHotelCities[visitedHotelCount] = city;
+        hashInsert(visitedIndex, visitedHash(hotelName, city), visitedHotelCount);
         visitedHotelCount++;
     }
 }
 
-bool isHotelBooked(string hotelName, string city) {
-    for (int i = 0; i < bookingCount; i++) {
-        if (bookings[i].isActive && bookings[i].hotelName == hotelName && bookings[i].city == city) {
-            return true;
+bool isHotelBooked(int hotelIndex) {
+    return hotelIndex >= 0 && hotelIndex < (int)hotelActiveBookings.size() && hotelActiveBookings[hotelIndex] > 0;
+}
+void indexStay(int bookingIndex) {
+    const Booking& b = bookingAt(bookingIndex);
+    stayIndex.byCheckIn.insert(make_pair(b.checkIn, bookingIndex));
+    stayIndex.lengths.insert(b.nights);
+}
+void unindexStay(int bookingIndex) {
+    const Booking& b = bookingAt(bookingIndex);
+    auto range = stayIndex.byCheckIn.equal_range(b.checkIn);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == bookingIndex) {
+            stayIndex.byCheckIn.erase(it);
+            stayIndex.lengths.erase(stayIndex.lengths.find(b.nights));
+            return;
         }
     }
-    return false;
 }
-bool hasDateConflict(int startDay, int startMonth, int numNights, int excludeIndex = -1) {
-    int endDay = startDay + numNights;
-    int endMonth = startMonth;
-    while (endDay > 30) {
-        endDay -= 30;
-        endMonth++;
+//Built from sorted runs, which the map and set take in linear time
+void buildStayIndex() {
+    vector<pair<DayNumber, int>> stays;
+    vector<int> lengths;
+    stays.reserve(bookingStore.live.size());
+    lengths.reserve(bookingStore.live.size());
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        const Booking& b = bookingAt(bookingStore.live[k]);
+        stays.push_back(make_pair(b.checkIn, bookingStore.live[k]));
+        lengths.push_back(b.nights);
+    }
+    sort(stays.begin(), stays.end());
+    sort(lengths.begin(), lengths.end());
+    stayIndex.byCheckIn = multimap<DayNumber, int>(stays.begin(), stays.end());
+    stayIndex.lengths = multiset<int>(lengths.begin(), lengths.end());
+}
+//True if an active booking other than excludeIndex overlaps nights
+//[checkIn, checkIn + numNights). Runs every frame on the detail and edit
+//screens, so it stops at the first one.
+bool hasDateConflict(DayNumber checkIn, int numNights, int excludeIndex = -1) {
+    if (stayIndex.lengths.empty() || numNights <= 0) return false;
+    int longestStay = *stayIndex.lengths.rbegin();
+    auto it = stayIndex.byCheckIn.upper_bound(checkIn - longestStay);
+    auto end = stayIndex.byCheckIn.lower_bound(checkIn + numNights);
+    for (; it != end; ++it) {
+        if (it->second != excludeIndex && bookingAt(it->second).checkOut > checkIn) return true;
     }
-
-    for (int i = 0; i < bookingCount; i++) {
-        if (i == excludeIndex) continue;
-        if (!bookings[i].isActive) continue;
-        
-        int bDay, bMonth, bYear;
-        parseDate(bookings[i].checkInDate, bDay, bMonth, bYear);
-        int bEndDay, bEndMonth, bEndYear;
-        parseDate(bookings[i].checkOutDate, bEndDay, bEndMonth, bEndYear);
-        
-        if (!(endDay < bDay || startDay > bEndDay)) {
-            return true;
-        }
-       }
     return false;
 }
 //Wrapper for original calls without exclude parameter
-bool hasDateConflictSimple(int startDay, int startMonth, int numNights){
-    return hasDateConflict(startDay, startMonth, numNights, -1);
+bool hasDateConflictSimple(DayNumber checkIn, int numNights){
+    return hasDateConflict(checkIn, numNights, -1);
 }
 //functions for color
-Color getCategoryColor(string category) {
-    if (category == "Luxury") return Color{168, 85, 247, 255};
-    if (category == "Budget") return Color{34, 197, 94, 255};
-    if (category == "Business") return Color{59, 130, 246, 255};
-    if (category == "Resort") return Color{236, 72, 153, 255};
-    if (category == "Heritage") return Color{234, 179, 8, 255};
-    return Color{107, 114, 128, 255};
-}
-
-Color getCityColor(string city) {
-    if (city == "Islamabad") return Color{34, 197, 94, 255};
-    if (city == "Lahore") return Color{239, 68, 68, 255};
-    if (city == "Karachi") return Color{59, 130, 246, 255};
-    if (city == "Peshawar") return Color{234, 179, 8, 255};
-    if (city == "Quetta") return Color{168, 85, 247, 255};
-    if (city == "Gilgit") return Color{14, 165, 233, 255};
-    if (city == "Muzaffarabad") return Color{236, 72, 153, 255};
-    return Color{107, 114, 128, 255};
+const Color CATEGORY_COLORS[MAX_CATEGORIES] = {
+    {168, 85, 247, 255},  // Luxury
+    {34, 197, 94, 255},   // Budget
+    {59, 130, 246, 255},  // Business
+    {236, 72, 153, 255},  // Resort
+    {234, 179, 8, 255}    // Heritage
+};
+const Color CITY_COLORS[MAX_CITIES] = {
+    {34, 197, 94, 255},   // Islamabad
+    {239, 68, 68, 255},   // Lahore
+    {59, 130, 246, 255},  // Karachi
+    {234, 179, 8, 255},   // Peshawar
+    {168, 85, 247, 255},  // Quetta
+    {14, 165, 233, 255},  // Gilgit
+    {236, 72, 153, 255}   // Muzaffarabad
+};
+Color getCategoryColor(int categoryId) {
+    if (categoryId < 0 || categoryId >= MAX_CATEGORIES) return Color{107, 114, 128, 255};
+    return CATEGORY_COLORS[categoryId];
+}
+
+Color getCityColor(int cityId) {
+    if (cityId < 0 || cityId >= MAX_CITIES) return Color{107, 114, 128, 255};
+    return CITY_COLORS[cityId];
+}
+//Look up the ID of a city or category name, returns -1 if unknown
+int findCityId(const string& city) {
+    for (int i = 0; i < MAX_CITIES; i++) {
+        if (CITIES[i] == city) return i;
+    }
+    return -1;
+}
+int findCategoryId(const string& category) {
+    for (int i = 0; i < MAX_CATEGORIES; i++) {
+        if (CATEGORIES[i] == category) return i;
+    }
+    return -1;
 }
 //Preferred Cities
-bool isCityPreferred(string city) {
+bool isCityPreferred(int cityId) {
     for (int i = 0; i < user.preferredCityCount; i++) {
-        if (user.preferredCities[i] == city) return true;
+        if (user.preferredCities[i] == cityId) return true;
     }
     return false;
 }
 //select city
-void togglePreferredCity(string city){
+void togglePreferredCity(int cityId){
     int foundIndex = -1;
     for (int i = 0; i < user.preferredCityCount; i++){
-        if (user.preferredCities[i] == city){
+        if (user.preferredCities[i] == cityId){
             foundIndex = i;
             break;
            }
@@ -344,7 +1165,7 @@ void togglePreferredCity(string city){
     } else{
         // Add city if room
         if (user.preferredCityCount < MAX_PREFERRED_CITIES){
-            user.preferredCities[user.preferredCityCount] = city;
+            user.preferredCities[user.preferredCityCount] = cityId;
             user.preferredCityCount++;
         }
     }
@@ -404,12 +1225,186 @@ void updateAchievements() {
 
 
 //helper functions for drawing gui elements
-void drawText(string text, int x, int y, int size, Color color){
+unsigned int textHash(const string& text, int size) {
+    return hashBytes((const char*)&size, sizeof(size), hashString(text));
+}
+//Drop every cached string and empty the atlas
+void clearTextCache() {
+    hashClear(textCache.index);
+    textCache.entries.clear();
+    textCache.queued.clear();
+    textCache.shelfX = 0;
+    textCache.shelfY = 0;
+    textCache.shelfHeight = 0;
+    textCache.wipeAtlas = true;  // done by the next updateTextCache
+}
+//Entry for (text, size), added the first time it is asked for
+int textEntry(const string& text, int size) {
+    unsigned int hash = textHash(text, size);
+    int slot = -1;
+    for (int e = hashNext(textCache.index, hash, slot); e != -1; e = hashNext(textCache.index, hash, slot)) {
+        if (textCache.entries[e].size == size && textCache.entries[e].text == text) {
+            textCache.entries[e].lastUsed = textCache.frame;
+            return e;
+        }
+    }
+    TextEntry entry;
+    entry.text = text;
+    entry.size = size;
+    entry.width = -1;
+    entry.height = 0;
+    entry.lastUsed = textCache.frame;
+    textCache.entries.push_back(entry);
+    hashInsert(textCache.index, hash, (int)textCache.entries.size() - 1);
+    return (int)textCache.entries.size() - 1;
+}
+//Measured once, and only for text whose size is asked for or that goes
+//into the atlas
+const TextEntry& measuredText(int e) {
+    TextEntry& entry = textCache.entries[e];
+    if (entry.width < 0) {
+        Vector2 measured = MeasureTextEx(appFont, entry.text.c_str(), (float)entry.size, 1);
+        entry.width = (int)measured.x;
+        entry.height = (int)ceilf(measured.y);
+    }
+    return entry;
+}
+void unloadTextCache() {
+    clearTextCache();
+    if (textCache.atlas.id != 0) UnloadRenderTexture(textCache.atlas);
+    textCache.atlas = RenderTexture2D();
+}
+//Keep the most recently used half of the strings. Their atlas places stay
+//valid; the space of the dropped ones comes back when the atlas is packed.
+void evictTextEntries() {
+    vector<unsigned int> used;
+    for (int e = 0; e < (int)textCache.entries.size(); e++) used.push_back(textCache.entries[e].lastUsed);
+    nth_element(used.begin(), used.begin() + used.size() / 2, used.end());
+    unsigned int cutoff = used[used.size() / 2];
+    vector<int> newIndex(textCache.entries.size(), -1);
+    int kept = 0;
+    hashClear(textCache.index);
+    for (int e = 0; e < (int)textCache.entries.size(); e++) {
+        if (textCache.entries[e].lastUsed < cutoff) continue;
+        if (kept != e) textCache.entries[kept] = move(textCache.entries[e]);
+        hashInsert(textCache.index, textHash(textCache.entries[kept].text, textCache.entries[kept].size), kept);
+        newIndex[e] = kept++;
+    }
+    textCache.entries.resize(kept);
+    int queued = 0;
+    for (int k = 0; k < (int)textCache.queued.size(); k++) {
+        int e = newIndex[textCache.queued[k].first];
+        if (e != -1) textCache.queued[queued++] = make_pair(e, textCache.queued[k].second);
+    }
+    textCache.queued.resize(queued);
+}
+//The atlas is full: empty it and queue only the images drawn last frame.
+//Older ones go back in when they are drawn again.
+void repackTextAtlas() {
+    textCache.queued.clear();
+    for (int e = 0; e < (int)textCache.entries.size(); e++) {
+        vector<TextImage>& images = textCache.entries[e].images;
+        for (int i = 0; i < (int)images.size(); i++) {
+            images[i].rect = {0, 0, 0, 0};
+            images[i].queued = images[i].lastFrame + 1 >= textCache.frame;
+            if (images[i].queued) textCache.queued.push_back(make_pair(e, i));
+        }
+    }
+    textCache.shelfX = 0;
+    textCache.shelfY = 0;
+    textCache.shelfHeight = 0;
+    textCache.wipeAtlas = true;
+}
+//Called once a frame before BeginDrawing, rasterizes the strings that
+//became stable last frame
+void updateTextCache() {
+    textCache.frame++;
+    if ((int)textCache.entries.size() >= TEXT_CACHE_LIMIT) evictTextEntries();
+    if (textCache.queued.empty()) return;
+    if (textCache.atlas.id == 0) {
+        textCache.atlas = LoadRenderTexture(TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE);
+        if (textCache.atlas.id == 0) {
+            textCache.queued.clear();
+            return;
+        }
+        SetTextureFilter(textCache.atlas.texture, TEXTURE_FILTER_POINT);
+        textCache.wipeAtlas = true;
+    }
+    //A second pass puts the strings still on screen back into a repacked atlas
+    for (int pass = 0; pass < 2 && !textCache.queued.empty(); pass++) {
+        BeginTextureMode(textCache.atlas);
+        if (textCache.wipeAtlas) {
+            ClearBackground(BLANK);
+            textCache.wipeAtlas = false;
+        }
+        //Nothing is under the new text, so adding gives the plain color and
+        //coverage that drawing with alpha blending expects later
+        BeginBlendMode(BLEND_ADD_COLORS);
+        bool full = false;
+        for (int k = 0; k < (int)textCache.queued.size(); k++) {
+            const TextEntry& entry = measuredText(textCache.queued[k].first);
+            TextImage& image = textCache.entries[textCache.queued[k].first].images[textCache.queued[k].second];
+            image.queued = false;
+            int w = entry.width + 2;
+            int h = max(entry.height, entry.size) + 2;
+            if (w > TEXT_ATLAS_SIZE) continue;
+            if (textCache.shelfX + w > TEXT_ATLAS_SIZE) {
+                textCache.shelfX = 0;
+                textCache.shelfY += textCache.shelfHeight;
+                textCache.shelfHeight = 0;
+            }
+            if (textCache.shelfY + h > TEXT_ATLAS_SIZE) {
+                full = true;
+                continue;
+            }
+            image.rect = {(float)textCache.shelfX, (float)textCache.shelfY, (float)w, (float)h};
+            DrawTextEx(appFont, entry.text.c_str(), {image.rect.x, image.rect.y}, (float)entry.size, 1, image.color);
+            textCache.shelfX += w;
+            textCache.shelfHeight = max(textCache.shelfHeight, h);
+        }
+        EndBlendMode();
+        EndTextureMode();
+        textCache.queued.clear();
+        if (!full) break;
+        if (pass == 0) repackTextAtlas();
+    }
+}
+void drawText(const string& text, int x, int y, int size, Color color){
+    int e = textEntry(text, size);
+    vector<TextImage>& images = textCache.entries[e].images;
+    int i = 0;
+    while (i < (int)images.size() && memcmp(&images[i].color, &color, sizeof(Color)) != 0) i++;
+    if (i == (int)images.size()) {
+        TextImage image;
+        image.color = color;
+        image.lastFrame = textCache.frame;
+        image.frames = 1;
+        image.queued = false;
+        image.rect = {0, 0, 0, 0};
+        images.push_back(image);
+    }
+    TextImage& image = images[i];
+    if (image.rect.width > 0) {
+        image.lastFrame = textCache.frame;
+        //Render textures are stored upside down
+        Rectangle source = {image.rect.x, TEXT_ATLAS_SIZE - image.rect.y - image.rect.height, image.rect.width,
+                            -image.rect.height};
+        DrawTextureRec(textCache.atlas.texture, source, {(float)x, (float)y}, WHITE);
+        return;
+    }
     DrawTextEx(appFont, text.c_str(), {(float)x, (float)y}, (float)size, 1, color);
+    if (image.lastFrame != textCache.frame) {
+        image.lastFrame = textCache.frame;
+        image.frames++;
+    }
+    if (image.frames >= TEXT_STABLE_FRAMES && !image.queued) {
+        image.queued = true;
+        textCache.queued.push_back(make_pair(e, i));
+    }
 }
 
-int measureText(string text, int size){
-    return (int)MeasureTextEx(appFont, text.c_str(), (float)size, 1).x;
+int measureText(const string& text, int size){
+    return measuredText(textEntry(text, size)).width;
 }
 //rounded box ui
 void drawRoundedBox(int x, int y, int w, int h, Color color){
@@ -421,7 +1416,7 @@ void drawRoundedBox(int x, int y, int w, int h, Color color){
     DrawCircle(x + w - 5, y + h - 5, 5, color);
 }
 //button with text
-bool drawButton(int x, int y, int w, int h, string text, Color color, int fontSize = 14){
+bool drawButton(int x, int y, int w, int h, const string& text, Color color, int fontSize = 14){
     Rectangle rect = {(float)x, (float)y, (float)w, (float)h};
     bool isHovering = CheckCollisionPointRec(GetMousePosition(), rect);
     drawRoundedBox(x, y, w, h, isHovering ? Fade(color, 0.8f) : color);
@@ -430,7 +1425,7 @@ bool drawButton(int x, int y, int w, int h, string text, Color color, int fontSi
     return isHovering && IsMouseButtonPressed(MOUSE_LEFT_BUTTON);
 }
 
-bool drawSmallButton(int x, int y, int w, int h, string text, Color color){
+bool drawSmallButton(int x, int y, int w, int h, const string& text, Color color){
     return drawButton(x, y, w, h, text, color, 12);
 }
 
@@ -447,7 +1442,7 @@ void handleTextInput(string& buffer, int maxLength){
     }
 }
 // Draw a standard screen header with back button
-void drawScreenHeader(string title, Screen backScreen) {
+void drawScreenHeader(const string& title, Screen backScreen) {
     ClearBackground(BG_LIGHT);
     DrawRectangle(0, 0, 1024, 60, BG_WHITE);
     if (drawButton(15, 12, 40, 40, "<", GRAY)) {
@@ -457,8 +1452,9 @@ void drawScreenHeader(string title, Screen backScreen) {
     drawText(title, (1024 - titleWidth) / 2, 18, 24, BLACK);
 }
 
-// Draw city filter buttons, returns selected city
-void drawCityFilterRow(string& selectedCity, int y) {
+// Draw city filter buttons, returns selected city. cityCounts (optional)
+// adds the number of results per city to each button.
+void drawCityFilterRow(string& selectedCity, int y, const int cityCounts[] = nullptr) {
     int filterX = 40;
     
     // "All" button
@@ -473,9 +1469,10 @@ void drawCityFilterRow(string& selectedCity, int y) {
     for (int i = 0; i < MAX_CITIES; i++) {
         const string& city = CITIES[i];
         bool isSelected = (selectedCity == city);
-        Color btnColor = isSelected ? getCityColor(city) : GRAY;
+        Color btnColor = isSelected ? getCityColor(i) : GRAY;
+        string label = cityCounts ? city + " (" + to_string(cityCounts[i]) + ")" : city;
         
-        if (drawSmallButton(filterX, y, 110, 30, city, btnColor)) {
+        if (drawSmallButton(filterX, y, 110, 30, label, btnColor)) {
             if (isSelected) {
                 selectedCity = "";  //Deselect
             } else {
@@ -485,55 +1482,58 @@ void drawCityFilterRow(string& selectedCity, int y) {
         filterX += 118;
     }
 }
-float getPriceMultiplier(const Hotel& hotel){
-    if (user.budgetMode) {// Budget mode gives discounts on budget hotels
-        if (hotel.category == "Budget") return 0.90f;
-        if (hotel.category == "Heritage") return 0.95f;
-        return 1.0f;
-    } else {    // Luxury mode adds service fees on luxury hotels
-        if (hotel.category == "Luxury") return 1.15f;
-        if (hotel.category == "Resort") return 1.10f;
-        return 1.0f;
-    }
+float getPriceMultiplier(int hotelIndex){
+    return MODE_MULTIPLIERS[user.budgetMode ? 1 : 0][hotels.categoryId[hotelIndex]];
+}
+//Hotel names live in one shared buffer, copy one out only when needed
+string getHotelName(int hotelIndex) {
+    unsigned int start = hotels.nameOffset[hotelIndex];
+    return string(hotels.nameData + start, hotels.nameOffset[hotelIndex + 1] - start);
+}
+bool hotelNameEquals(int hotelIndex, const string& name) {
+    unsigned int start = hotels.nameOffset[hotelIndex];
+    unsigned int length = hotels.nameOffset[hotelIndex + 1] - start;
+    return length == name.length() && memcmp(hotels.nameData + start, name.data(), length) == 0;
 }
 // Draw a hotel card with all info, handles click to view details
 //it Returns true if clicked
 bool drawHotelCard(int hotelIndex, int x, int y, int width, int height, bool showRating) {
-    const Hotel& h = hotels[hotelIndex];
+    string name = getHotelName(hotelIndex);
+    int cityId = hotels.cityId[hotelIndex];
     
     // Card background
     drawRoundedBox(x, y, width, height, BG_WHITE);
-    drawRoundedBox(x, y, 8, height, getCityColor(h.city));
+    drawRoundedBox(x, y, 8, height, getCityColor(cityId));
     
     // Hotel name
-    drawText(h.name, x + 25, y + 12, 18, BLACK);
+    drawText(name, x + 25, y + 12, 18, BLACK);
     
     // Visited and Booked label
-    int nameWidth = measureText(h.name, 18);
-    if (isHotelVisited(h.name, h.city)) {
+    int nameWidth = measureText(name, 18);
+    if (isHotelVisited(name, CITIES[cityId])) {
         drawRoundedBox(x + 35 + nameWidth, y + 10, 60, 22, Color{34, 197, 94, 255});
         drawText("Visited", x + 42 + nameWidth, y + 13, 12, BG_WHITE);
-    } else if (isHotelBooked(h.name, h.city)) {
+    } else if (isHotelBooked(hotelIndex)) {
         drawRoundedBox(x + 35 + nameWidth, y + 10, 60, 22, Color{59, 130, 246, 255});
         drawText("Booked", x + 42 + nameWidth, y + 13, 12, BG_WHITE);
     }
     
     // Price with multiplier
-    float priceMultiplier = getPriceMultiplier(h);
-    string info = h.city + " | " + h.category + " | Rs." + 
-                  to_string((int)(h.currentPrice * priceMultiplier)) + "/night";
+    float priceMultiplier = getPriceMultiplier(hotelIndex);
+    string info = CITIES[cityId] + " | " + CATEGORIES[hotels.categoryId[hotelIndex]] + " | Rs." + 
+                  to_string((int)(hotels.currentPrice[hotelIndex] * priceMultiplier)) + "/night";
     drawText(info, x + 25, y + 38, 14, GRAY);
     
     // Deal badge
-    if (h.hasDeal) {
-        string deal = to_string((int)h.dealPercent) + "% OFF!";
+    if (hotels.flags[hotelIndex] & HOTEL_DEAL) {
+        string deal = to_string((int)hotels.dealPercent[hotelIndex]) + "% OFF!";
         drawRoundedBox(x + width - 140, y + 10, 80, 25, Color{239, 68, 68, 255});
         drawText(deal, x + width - 128, y + 15, 13, BG_WHITE);
     }
     
     // Rating
     if (showRating) {
-        string rating = to_string(h.rating).substr(0, 3);
+        string rating = to_string(hotels.rating[hotelIndex]).substr(0, 3);
         drawText(rating, x + width - 50, y + 35, 18, Color{234, 179, 8, 255});
     }
     
@@ -544,9 +1544,7 @@ bool drawHotelCard(int hotelIndex, int x, int y, int width, int height, bool sho
         selectedHotelIndex = hotelIndex;
         nights = 1;
         guests = 2;
-        bookingDay = appDay;
-        bookingMonth = appMonth;
-        bookingYear = appYear;
+        bookingDate = appDate;
         currentScreen = SCREEN_DETAIL;
         return true;
     }
@@ -568,103 +1566,1188 @@ bool drawInputField(string label, string& value, int x, int y, int labelWidth, i
     return false;
 }
 
-//Draw scroll buttons for lists
-void drawScrollButtons(int& scrollPos, int totalItems, int visibleItems, int y) {
-    if (scrollPos > 0 && drawButton(450, y, 70, 35, "Up", GRAY)) {
-        scrollPos--;
+//Name search index
+unsigned int packTrigram(const char* text) {
+    return ((unsigned int)(unsigned char)text[0] << 16) |
+           ((unsigned int)(unsigned char)text[1] << 8) |
+           (unsigned int)(unsigned char)text[2];
+}
+//Distinct trigrams of a lowercased string, sorted
+void collectTrigrams(const char* text, int length, vector<unsigned int>& out) {
+    out.clear();
+    for (int i = 0; i + 3 <= length; i++) out.push_back(packTrigram(text + i));
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+}
+void indexHotelName(int hotelIndex) {
+    unsigned int start = hotels.nameOffset[hotelIndex];
+    unsigned int end = hotels.nameOffset[hotelIndex + 1];
+    for (unsigned int c = start; c < end; c++) {
+        nameIndex.lowerNames += (char)tolower((unsigned char)hotels.nameData[c]);
+    }
+    if (!(hotels.flags[hotelIndex] & HOTEL_ACTIVE)) return;
+    vector<unsigned int> trigrams;
+    collectTrigrams(nameIndex.lowerNames.data() + start, (int)(end - start), trigrams);
+    for (int t = 0; t < (int)trigrams.size(); t++) {
+        //IDs are added in increasing order so each list stays sorted
+        nameIndex.postings[trigrams[t]].push_back(hotelIndex);
+    }
+}
+void unindexHotelName(int hotelIndex) {
+    unsigned int start = hotels.nameOffset[hotelIndex];
+    unsigned int end = hotels.nameOffset[hotelIndex + 1];
+    vector<unsigned int> trigrams;
+    collectTrigrams(nameIndex.lowerNames.data() + start, (int)(end - start), trigrams);
+    for (int t = 0; t < (int)trigrams.size(); t++) {
+        vector<int>& list = nameIndex.postings[trigrams[t]];
+        vector<int>::iterator it = lower_bound(list.begin(), list.end(), hotelIndex);
+        if (it != list.end() && *it == hotelIndex) list.erase(it);
+    }
+}
+void buildNameIndex() {
+    nameIndex.lowerNames.clear();
+    nameIndex.lowerNames.reserve(hotels.nameOffset[hotelCount]);
+    nameIndex.postings.clear();
+    for (int i = 0; i < hotelCount; i++) indexHotelName(i);
+    nameIndex.built = true;
+}
+void clearNameIndex() {
+    nameIndex.built = false;
+    nameIndex.lowerNames.clear();
+    nameIndex.postings.clear();
+}
+bool lowerNameContains(int hotelIndex, const string& lowerQuery) {
+    const char* start = nameIndex.lowerNames.data() + hotels.nameOffset[hotelIndex];
+    const char* end = nameIndex.lowerNames.data() + hotels.nameOffset[hotelIndex + 1];
+    return search(start, end, lowerQuery.begin(), lowerQuery.end()) != end;
+}
+//Sorted IDs of active hotels whose name contains the lowercased query.
+//Intersects the posting lists of the query trigrams, smallest list first,
+//then checks each survivor because sharing trigrams is not a substring match.
+void findHotelsByName(const string& lowerQuery, vector<int>& out) {
+    out.clear();
+    int length = (int)lowerQuery.length();
+    if (length < 3) {
+        //Too short for trigrams, scan the lowercased names
+        for (int i = 0; i < hotelCount; i++) {
+            if ((hotels.flags[i] & HOTEL_ACTIVE) && lowerNameContains(i, lowerQuery)) out.push_back(i);
+        }
+        return;
+    }
+    vector<unsigned int> trigrams;
+    collectTrigrams(lowerQuery.data(), length, trigrams);
+    vector<const vector<int>*> lists;
+    for (int t = 0; t < (int)trigrams.size(); t++) {
+        unordered_map<unsigned int, vector<int>>::const_iterator it = nameIndex.postings.find(trigrams[t]);
+        if (it == nameIndex.postings.end() || it->second.empty()) return;
+        lists.push_back(&it->second);
+    }
+    sort(lists.begin(), lists.end(),
+         [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+
+    out = *lists[0];
+    for (int l = 1; l < (int)lists.size() && !out.empty(); l++) {
+        const vector<int>& list = *lists[l];
+        int kept = 0;
+        vector<int>::const_iterator it = list.begin();
+        for (int k = 0; k < (int)out.size(); k++) {
+            it = lower_bound(it, list.end(), out[k]);
+            if (it == list.end()) break;
+            if (*it == out[k]) out[kept++] = out[k];
+        }
+        out.resize(kept);
     }
-    if (scrollPos + visibleItems < totalItems && drawButton(530, y, 70, 35, "Down", GRAY)) {
-        scrollPos++;
+    int kept = 0;
+    for (int k = 0; k < (int)out.size(); k++) {
+        if (lowerNameContains(out[k], lowerQuery)) out[kept++] = out[k];
+    }
+    out.resize(kept);
+}
+//Price index
+float effectivePriceForMode(int hotelIndex, int mode) {
+    return hotels.currentPrice[hotelIndex] * MODE_MULTIPLIERS[mode][hotels.categoryId[hotelIndex]];
+}
+//Position of (price, hotel) in a price index, or where it would be inserted
+int priceIndexPosition(const PriceIndex& index, float price, int hotelIndex) {
+    int low = 0, high = (int)index.hotelIds.size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (index.prices[mid] < price || (index.prices[mid] == price && index.hotelIds[mid] < hotelIndex)) low = mid + 1;
+        else high = mid;
     }
+    return low;
+}
+void buildPriceIndex() {
+    for (int mode = 0; mode < 2; mode++) {
+        PriceIndex& index = priceIndex[mode];
+        vector<pair<float, int>> entries;
+        entries.reserve(hotelCount);
+        for (int i = 0; i < hotelCount; i++) {
+            if (hotels.flags[i] & HOTEL_ACTIVE) entries.push_back(make_pair(effectivePriceForMode(i, mode), i));
+        }
+        sort(entries.begin(), entries.end());
+        index.hotelIds.resize(entries.size());
+        index.prices.resize(entries.size());
+        for (int k = 0; k < (int)entries.size(); k++) {
+            index.prices[k] = entries[k].first;
+            index.hotelIds[k] = entries[k].second;
+        }
+    }
+    priceIndexBuilt = true;
+}
+//Re-position hotels whose price changed. Unchanged entries keep their order,
+//so only the changed ones are sorted and then merged back in one pass.
+void updatePriceIndex(const vector<int>& changed, const vector<float>& oldPrices) {
+    if (!priceIndexBuilt || changed.empty()) return;
+    for (int mode = 0; mode < 2; mode++) {
+        PriceIndex& index = priceIndex[mode];
+        //Drop the changed hotels using their old positions
+        vector<bool> removed(index.hotelIds.size(), false);
+        for (int k = 0; k < (int)changed.size(); k++) {
+            int h = changed[k];
+            float oldPrice = oldPrices[k] * MODE_MULTIPLIERS[mode][hotels.categoryId[h]];
+            int pos = priceIndexPosition(index, oldPrice, h);
+            if (pos < (int)index.hotelIds.size() && index.hotelIds[pos] == h) removed[pos] = true;
+        }
+        vector<pair<float, int>> moved;
+        moved.reserve(changed.size());
+        for (int k = 0; k < (int)changed.size(); k++) {
+            int h = changed[k];
+            if (hotels.flags[h] & HOTEL_ACTIVE) moved.push_back(make_pair(effectivePriceForMode(h, mode), h));
+        }
+        sort(moved.begin(), moved.end());
+
+        int total = (int)index.hotelIds.size();
+        vector<int> mergedIds;
+        vector<float> mergedPrices;
+        mergedIds.reserve(total + moved.size());
+        mergedPrices.reserve(total + moved.size());
+        int m = 0;
+        for (int k = 0; k <= total; k++) {
+            bool atEnd = (k == total);
+            while (m < (int)moved.size() &&
+                   (atEnd || moved[m].first < index.prices[k] ||
+                    (moved[m].first == index.prices[k] && moved[m].second < index.hotelIds[k]))) {
+                mergedPrices.push_back(moved[m].first);
+                mergedIds.push_back(moved[m].second);
+                m++;
+            }
+            if (atEnd) break;
+            if (removed[k]) continue;
+            mergedPrices.push_back(index.prices[k]);
+            mergedIds.push_back(index.hotelIds[k]);
+        }
+        index.hotelIds.swap(mergedIds);
+        index.prices.swap(mergedPrices);
+    }
+}
+void insertIntoPriceIndex(int hotelIndex) {
+    if (!priceIndexBuilt) return;
+    for (int mode = 0; mode < 2; mode++) {
+        PriceIndex& index = priceIndex[mode];
+        float price = effectivePriceForMode(hotelIndex, mode);
+        int pos = priceIndexPosition(index, price, hotelIndex);
+        index.hotelIds.insert(index.hotelIds.begin() + pos, hotelIndex);
+        index.prices.insert(index.prices.begin() + pos, price);
+    }
+}
+void removeFromPriceIndex(int hotelIndex) {
+    if (!priceIndexBuilt) return;
+    for (int mode = 0; mode < 2; mode++) {
+        PriceIndex& index = priceIndex[mode];
+        int pos = priceIndexPosition(index, effectivePriceForMode(hotelIndex, mode), hotelIndex);
+        if (pos < (int)index.hotelIds.size() && index.hotelIds[pos] == hotelIndex) {
+            index.hotelIds.erase(index.hotelIds.begin() + pos);
+            index.prices.erase(index.prices.begin() + pos);
+        }
+    }
+}
+//Entries [first, last) of the mode's price index inside the price range
+void priceIndexRange(int mode, float minPrice, float maxPrice, int& first, int& last) {
+    const vector<float>& prices = priceIndex[mode].prices;
+    first = (int)(lower_bound(prices.begin(), prices.end(), minPrice) - prices.begin());
+    last = (int)(upper_bound(prices.begin(), prices.end(), maxPrice) - prices.begin());
+    if (last < first) last = first;
+}
+
+//Bitmaps
+int popcount64(unsigned long long word) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(word);
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+int lowestBit64(unsigned long long word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+void bitmapReset(HotelBitmap& bitmap) {
+    bitmap.words.assign((hotelCount + 63) / 64, 0);
+}
+void bitmapSet(HotelBitmap& bitmap, int hotelIndex, bool on) {
+    int word = hotelIndex / 64;
+    if (word >= (int)bitmap.words.size()) bitmap.words.resize(word + 1, 0);
+    unsigned long long bit = 1ULL << (hotelIndex % 64);
+    if (on) bitmap.words[word] |= bit;
+    else bitmap.words[word] &= ~bit;
+}
+bool bitmapTest(const HotelBitmap& bitmap, int hotelIndex) {
+    int word = hotelIndex / 64;
+    return word < (int)bitmap.words.size() && (bitmap.words[word] >> (hotelIndex % 64)) & 1;
+}
+int bitmapCountAnd(const HotelBitmap& a, const HotelBitmap& b) {
+    int words = (int)min(a.words.size(), b.words.size());
+    int count = 0;
+    for (int w = 0; w < words; w++) count += popcount64(a.words[w] & b.words[w]);
+    return count;
+}
+//a &= b
+void bitmapAnd(HotelBitmap& a, const HotelBitmap& b) {
+    if (a.words.size() > b.words.size()) a.words.resize(b.words.size());
+    for (int w = 0; w < (int)a.words.size(); w++) a.words[w] &= b.words[w];
+}
+void bitmapFromList(const vector<int>& hotelList, HotelBitmap& bitmap) {
+    bitmapReset(bitmap);
+    for (int k = 0; k < (int)hotelList.size(); k++) bitmapSet(bitmap, hotelList[k], true);
+}
+void setHotelFacets(int hotelIndex) {
+    unsigned char flags = hotels.flags[hotelIndex];
+    bitmapSet(facets.active, hotelIndex, (flags & HOTEL_ACTIVE) != 0);
+    bitmapSet(facets.city[hotels.cityId[hotelIndex]], hotelIndex, true);
+    bitmapSet(facets.category[hotels.categoryId[hotelIndex]], hotelIndex, true);
+    bitmapSet(facets.wifi, hotelIndex, (flags & HOTEL_WIFI) != 0);
+    bitmapSet(facets.pool, hotelIndex, (flags & HOTEL_POOL) != 0);
+    bitmapSet(facets.deal, hotelIndex, (flags & HOTEL_DEAL) != 0);
+}
+void buildFacetBitmaps() {
+    bitmapReset(facets.active);
+    for (int c = 0; c < MAX_CITIES; c++) bitmapReset(facets.city[c]);
+    for (int c = 0; c < MAX_CATEGORIES; c++) bitmapReset(facets.category[c]);
+    bitmapReset(facets.wifi);
+    bitmapReset(facets.pool);
+    bitmapReset(facets.deal);
+    for (int i = 0; i < hotelCount; i++) setHotelFacets(i);
+}
+//Bitmap of active hotels in the allowed cities and categories that have all
+//the required amenity / deal flags
+void buildFacetFilter(const bool cityMatch[], const bool categoryMatch[], unsigned char requiredFlags,
+                      HotelBitmap& out) {
+    int words = (hotelCount + 63) / 64;
+    out.words.assign(words, 0);
+    for (int c = 0; c < MAX_CITIES; c++) {
+        if (!cityMatch[c]) continue;
+        const vector<unsigned long long>& bits = facets.city[c].words;
+        for (int w = 0; w < words && w < (int)bits.size(); w++) out.words[w] |= bits[w];
+    }
+    unsigned long long* result = out.words.data();
+    HotelBitmap categories;
+    categories.words.assign(words, 0);
+    for (int c = 0; c < MAX_CATEGORIES; c++) {
+        if (!categoryMatch[c]) continue;
+        const vector<unsigned long long>& bits = facets.category[c].words;
+        for (int w = 0; w < words && w < (int)bits.size(); w++) categories.words[w] |= bits[w];
+    }
+    for (int w = 0; w < words; w++) {
+        unsigned long long word = result[w] & categories.words[w] & facets.active.words[w];
+        if (requiredFlags & HOTEL_WIFI) word &= facets.wifi.words[w];
+        if (requiredFlags & HOTEL_POOL) word &= facets.pool.words[w];
+        if (requiredFlags & HOTEL_DEAL) word &= facets.deal.words[w];
+        result[w] = word;
+    }
+}
+
+//Take a hotel off sale, it stays in the catalog but no longer shows up in searches
+void deactivateHotel(int hotelIndex) {
+    if (hotelIndex < 0 || hotelIndex >= hotelCount) return;
+    if (!(hotels.flags[hotelIndex] & HOTEL_ACTIVE)) return;
+    if (nameIndex.built) unindexHotelName(hotelIndex);
+    removeFromPriceIndex(hotelIndex);
+    hotels.flags[hotelIndex] &= ~HOTEL_ACTIVE;
+    bitmapSet(facets.active, hotelIndex, false);
+    priceEpoch++;
+}
+//Extend the city's last run when the hotel directly follows it
+void addToCityRuns(int hotelIndex) {
+    vector<CityRun>& runs = cityRuns[hotels.cityId[hotelIndex]];
+    if (!runs.empty() && runs.back().first + runs.back().count == hotelIndex) runs.back().count++;
+    else runs.push_back({hotelIndex, 1});
+}
+void buildCityRuns() {
+    for (int c = 0; c < MAX_CITIES; c++) cityRuns[c].clear();
+    for (int i = 0; i < hotelCount; i++) addToCityRuns(i);
+}
+
+unsigned int hotelKeyHash(const char* name, size_t length, int cityId) {
+    return hashBytes(name, length, 2166136261u ^ (unsigned int)(cityId + 1) * 0x9E3779B1u);
+}
+void indexHotelKey(int hotelIndex) {
+    unsigned int start = hotels.nameOffset[hotelIndex];
+    hashInsert(hotelKeyIndex, hotelKeyHash(hotels.nameData + start, hotels.nameOffset[hotelIndex + 1] - start,
+                                           hotels.cityId[hotelIndex]), hotelIndex);
+}
+void buildHotelKeyIndex() {
+    hashClear(hotelKeyIndex);
+    for (int i = 0; i < hotelCount; i++) indexHotelKey(i);
+}
+int findHotel(const string& name, int cityId) {
+    unsigned int hash = hotelKeyHash(name.data(), name.length(), cityId);
+    int slot = -1;
+    for (int h = hashNext(hotelKeyIndex, hash, slot); h != -1; h = hashNext(hotelKeyIndex, hash, slot)) {
+        if (hotels.cityId[h] == cityId && hotelNameEquals(h, name)) return h;
+    }
+    return -1;
+}
+//Callers hold hotelLock(hotelIndex)
+int roomsBookedOn(int hotelIndex, DayNumber night) {
+    const map<DayNumber, int>& nights = hotelNights[hotelIndex];
+    auto it = nights.find(night);
+    return it == nights.end() ? 0 : it->second;
+}
+//Fewest rooms free on any night of [checkIn, checkIn + nights), callers hold hotelLock(hotelIndex)
+int roomsFree(int hotelIndex, DayNumber checkIn, int nights) {
+    const map<DayNumber, int>& booked = hotelNights[hotelIndex];
+    int rooms = hotels.roomCount[hotelIndex];
+    int available = rooms;
+    auto last = booked.lower_bound(checkIn + nights);
+    for (auto it = booked.lower_bound(checkIn); it != last; ++it) available = min(available, rooms - it->second);
+    return max(available, 0);
+}
+int roomsAvailable(int hotelIndex, DayNumber checkIn, int nights) {
+    lock_guard<mutex> lock(hotelLock(hotelIndex));
+    return roomsFree(hotelIndex, checkIn, nights);
+}
+//Callers hold hotelLock(hotelIndex). The shared night bitmaps are only
+//touched when the hotel-night turns booked, free, full or not full.
+void changeRoomsBooked(int hotelIndex, DayNumber night, int delta) {
+    map<DayNumber, int>& nights = hotelNights[hotelIndex];
+    //Nights before today are never queried again, drop them on the way
+    while (!nights.empty() && nights.begin()->first < appDate) nights.erase(nights.begin());
+    int rooms = hotels.roomCount[hotelIndex];
+    int& booked = nights[night];
+    int before = booked;
+    booked += delta;
+    if ((before > 0) != (booked > 0) || (before >= rooms) != (booked >= rooms)) {
+        lock_guard<mutex> lock(inventoryMutex);
+        NightInventory& inventory = roomInventory[night];
+        if ((before > 0) != (booked > 0)) {
+            bitmapSet(inventory.booked, hotelIndex, booked > 0);
+            inventory.hotelsBooked += booked > 0 ? 1 : -1;
+        }
+        bitmapSet(inventory.soldOut, hotelIndex, booked >= rooms);
+        if (inventory.hotelsBooked == 0) roomInventory.erase(night);
+    }
+    if (booked <= 0) nights.erase(night);
+    inventoryEpoch++;
+}
+//Take the rooms on every night of the stay, or on none if any night is short.
+//Callers hold hotelLock(hotelIndex).
+bool reserveRooms(int hotelIndex, DayNumber checkIn, int nights, int rooms) {
+    if (roomsFree(hotelIndex, checkIn, nights) < rooms) return false;
+    for (int d = 0; d < nights; d++) changeRoomsBooked(hotelIndex, checkIn + d, rooms);
+    return true;
+}
+//Nights already dropped from the inventory are skipped. Callers hold hotelLock(hotelIndex).
+void releaseRooms(int hotelIndex, DayNumber checkIn, int nights, int rooms) {
+    for (int d = 0; d < nights; d++) {
+        if (checkIn + d < appDate) continue;
+        int booked = roomsBookedOn(hotelIndex, checkIn + d);
+        if (booked > 0) changeRoomsBooked(hotelIndex, checkIn + d, -min(rooms, booked));
+    }
+}
+void releaseBookingRooms(const Booking& booking) {
+    if (booking.hotelId != -1) releaseRooms(booking.hotelId, booking.checkIn, booking.nights, booking.rooms);
+}
+//Resolve each booking's hotel and rebuild the booking ID index and the
+//active count per hotel. Bookings are loaded before the catalog, so this
+//runs once the hotels are in.
+void buildBookingIndexes() {
+    hashClear(bookingIdIndex);
+    hotelActiveBookings.assign(hotelCount, 0);
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        Booking& b = bookingAt(bookingStore.live[k]);
+        b.hotelId = findHotel(b.hotelName, findCityId(b.city));
+        hashInsert(bookingIdIndex, bookingIdHash(b.bookingId), bookingStore.live[k]);
+        if (b.hotelId != -1) hotelActiveBookings[b.hotelId]++;
+    }
+}
+//Rebuild from the active bookings, loaded stays are kept even if they overbook.
+//Parked travelers hold their rooms again when they are next served.
+void buildRoomInventory() {
+    for (int s = 0; s < PROFILE_SHARDS; s++) {
+        lock_guard<mutex> lock(profileShards[s].lock);
+        for (auto it = profileShards[s].profiles.begin(); it != profileShards[s].profiles.end(); ++it) {
+            it->second.roomsHeld = false;
+        }
+    }
+    roomInventory.clear();
+    hotelNights.assign(hotelCount, map<DayNumber, int>());
+    inventoryEpoch++;
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        const Booking& b = bookingAt(bookingStore.live[k]);
+        if (b.hotelId == -1) continue;
+        for (int d = 0; d < b.nights; d++) {
+            if (b.checkIn + d >= appDate) changeRoomsBooked(b.hotelId, b.checkIn + d, b.rooms);
+        }
+    }
+}
+//Nights before today can no longer be booked, the hotels drop theirs when next touched
+void pruneRoomInventory() {
+    lock_guard<mutex> lock(inventoryMutex);
+    while (!roomInventory.empty() && roomInventory.begin()->first < appDate) {
+        roomInventory.erase(roomInventory.begin());
+        inventoryEpoch++;
+    }
+}
+//Active hotels with at least `rooms` rooms free on every night of the range
+void availableHotels(DayNumber checkIn, int nights, int rooms, HotelBitmap& out) {
+    int words = (hotelCount + 63) / 64;
+    out.words.assign(facets.active.words.begin(), facets.active.words.end());
+    out.words.resize(words, 0);
+    unsigned long long* result = out.words.data();
+    if (rooms > 1) {
+        for (int i = 0; i < hotelCount; i++) {
+            if (hotels.roomCount[i] < rooms) result[i / 64] &= ~(1ULL << (i % 64));
+        }
+    }
+    //Hotels with some rooms booked but none sold out, checked one by one
+    //below when more than one room is asked for
+    vector<unsigned long long> partlyBooked;
+    if (rooms > 1) partlyBooked.assign(words, 0);
+    {
+        lock_guard<mutex> lock(inventoryMutex);
+        auto last = roomInventory.lower_bound(checkIn + nights);
+        for (auto it = roomInventory.lower_bound(checkIn); it != last; ++it) {
+            const vector<unsigned long long>& full = it->second.soldOut.words;
+            int count = min(words, (int)full.size());
+            for (int w = 0; w < count; w++) result[w] &= ~full[w];
+            if (rooms <= 1) continue;
+            const vector<unsigned long long>& booked = it->second.booked.words;
+            count = min(words, (int)booked.size());
+            for (int w = 0; w < count; w++) partlyBooked[w] |= booked[w];
+        }
+    }
+    //Hotels with some rooms left but fewer than asked for
+    for (int w = 0; w < (int)partlyBooked.size(); w++) {
+        unsigned long long candidates = partlyBooked[w] & result[w];
+        while (candidates) {
+            int h = w * 64 + lowestBit64(candidates);
+            candidates &= candidates - 1;
+            if (roomsAvailable(h, checkIn, nights) < rooms) result[w] &= ~(1ULL << (h % 64));
+        }
+    }
+}
+
+//Point the static columns at the owned vectors (after they grow or get copied)
+void useOwnedCatalogColumns() {
+    hotels.basePrice = hotels.ownBasePrice.data();
+    hotels.rating = hotels.ownRating.data();
+    hotels.cityId = hotels.ownCityId.data();
+    hotels.categoryId = hotels.ownCategoryId.data();
+    hotels.roomCount = hotels.ownRoomCount.data();
+    hotels.nameOffset = hotels.ownNameOffset.data();
+    hotels.nameData = hotels.ownNameData.data();
+}
+void clearCatalog() {
+    clearNameIndex();
+    hashClear(hotelKeyIndex);
+    hotelActiveBookings.clear();
+    hotelNights.clear();
+    for (int c = 0; c < MAX_CITIES; c++) cityRuns[c].clear();
+    priceIndexBuilt = false;
+    hotels = HotelCatalog();
+    hotels.ownNameOffset.push_back(0);
+    useOwnedCatalogColumns();
+    hotelCount = 0;
+}
+//Map a whole file read-only. Windows reads it into one buffer instead,
+//windows.h clashes with raylib names.
+bool mapFile(const char* path, MappedFile& file) {
+    file.data = nullptr;
+    file.size = 0;
+    file.isMapped = false;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    file.data = (const unsigned char*)data;
+    file.size = (size_t)info.st_size;
+    file.isMapped = true;
+    return true;
+#else
+    FILE* fp = fopen(path, "rb");
+    if (fp == nullptr) return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(fp);
+        return false;
+    }
+    unsigned char* buffer = new unsigned char[size];
+    bool ok = fread(buffer, 1, (size_t)size, fp) == (size_t)size;
+    fclose(fp);
+    if (!ok) {
+        delete[] buffer;
+        return false;
+    }
+    file.data = buffer;
+    file.size = (size_t)size;
+    return true;
+#endif
+}
+void unmapFile(MappedFile& file) {
+    if (file.data == nullptr) return;
+#ifndef _WIN32
+    if (file.isMapped) munmap((void*)file.data, file.size);
+    else delete[] file.data;
+#else
+    delete[] file.data;
+#endif
+    file.data = nullptr;
+    file.size = 0;
+    file.isMapped = false;
+}
+//Copy the mapped static columns into owned storage so hotels can be appended
+void detachCatalogFile() {
+    if (catalogFile.data == nullptr) return;
+    hotels.ownBasePrice.assign(hotels.basePrice, hotels.basePrice + hotelCount);
+    hotels.ownRating.assign(hotels.rating, hotels.rating + hotelCount);
+    hotels.ownCityId.assign(hotels.cityId, hotels.cityId + hotelCount);
+    hotels.ownCategoryId.assign(hotels.categoryId, hotels.categoryId + hotelCount);
+    //Version 1 files already have their room counts in owned storage
+    if (hotels.roomCount != hotels.ownRoomCount.data()) {
+        hotels.ownRoomCount.assign(hotels.roomCount, hotels.roomCount + hotelCount);
+    }
+    hotels.ownNameOffset.assign(hotels.nameOffset, hotels.nameOffset + hotelCount + 1);
+    hotels.ownNameData.assign(hotels.nameData, hotels.nameOffset[hotelCount]);
+    useOwnedCatalogColumns();
+    unmapFile(catalogFile);
+}
+//Append one hotel, amenities are HOTEL_WIFI / HOTEL_POOL bits
+void appendHotel(const string& name, int cityId, int categoryId, float price, float rating, unsigned char amenities,
+                 int rooms) {
+    detachCatalogFile();
+    hotels.ownNameData += name;
+    hotels.ownNameOffset.push_back((unsigned int)hotels.ownNameData.length());
+    hotels.ownBasePrice.push_back(price);
+    hotels.ownRating.push_back(rating);
+    hotels.ownCityId.push_back((unsigned char)cityId);
+    hotels.ownCategoryId.push_back((unsigned char)categoryId);
+    hotels.ownRoomCount.push_back((unsigned short)rooms);
+    useOwnedCatalogColumns();
+    //Start at today's weather price, only weather changes reprice it later
+    float weatherMultiplier = 1.0f;
+    for (int i = 0; i < weatherCount; i++) {
+        if (weatherData[i].cityId == cityId) weatherMultiplier = weatherData[i].priceMultiplier;
+    }
+    hotels.currentPrice.push_back(clamp(price * weatherMultiplier, 500.0f, 200000.0f));
+    hotels.dealPercent.push_back(0);
+    hotels.dealEndDay.push_back(0);
+    hotels.flags.push_back((amenities & (HOTEL_WIFI | HOTEL_POOL)) | HOTEL_ACTIVE);
+    hotelActiveBookings.push_back(0);
+    hotelNights.push_back(map<DayNumber, int>());
+    hotelCount++;
+    addToCityRuns(hotelCount - 1);
+    indexHotelKey(hotelCount - 1);
+    if (nameIndex.built) indexHotelName(hotelCount - 1);
+    insertIntoPriceIndex(hotelCount - 1);
+    setHotelFacets(hotelCount - 1);
+    priceEpoch++;
 }
 // Add hotel helper
 void addHotel(string name, string city, string category, float price, float rating, bool hasPool) {
-    if (hotelCount >= MAX_HOTELS) return;
-    Hotel h;
-    h.name = name;
-    h.city = city;
-    h.category = category;
-    h.basePrice = price;
-    h.currentPrice = price;
-    h.rating = rating;
-    h.hasWifi = true;
-    h.hasPool = hasPool;
-    h.isActive = true;
-    h.hasDeal = (rand() % 5 == 0);
-    if (h.hasDeal) {
-        h.dealPercent = 10 + rand() % 21;}
-    else {
-        h.dealPercent = 0;}
-    hotels[hotelCount++] = h;
+    int cityId = findCityId(city);
+    int categoryId = findCategoryId(category);
+    if (cityId == -1 || categoryId == -1) return;
+    appendHotel(name, cityId, categoryId, price, rating, hasPool ? (HOTEL_WIFI | HOTEL_POOL) : HOTEL_WIFI,
+                CATEGORY_ROOMS[categoryId]);
+}
+//Give roughly one hotel in five a random deal
+//Deals last DEAL_MIN_DAYS..DEAL_MAX_DAYS days
+const int DEAL_MIN_DAYS = 3;
+const int DEAL_MAX_DAYS = 10;
+void startHotelDeal(int hotelIndex) {
+    hotels.flags[hotelIndex] |= HOTEL_DEAL;
+    hotels.dealPercent[hotelIndex] = 10 + rand() % 21;
+    hotels.dealEndDay[hotelIndex] = appDate + DEAL_MIN_DAYS + rand() % (DEAL_MAX_DAYS - DEAL_MIN_DAYS + 1);
+    scheduleEvent(hotels.dealEndDay[hotelIndex], EVENT_DEAL_END, hotelIndex);
+}
+void rollHotelDeals() {
+    for (int i = 0; i < hotelCount; i++) {
+        if (rand() % 5 == 0) {
+            startHotelDeal(i);
+        } else {
+            hotels.flags[i] &= ~HOTEL_DEAL;
+            hotels.dealPercent[i] = 0;
+        }
+    }
+    buildFacetBitmaps();
+}
+//Deal end events for deals that were replaced since are ignored
+bool endHotelDeal(int hotelIndex, DayNumber day) {
+    if (!(hotels.flags[hotelIndex] & HOTEL_DEAL) || hotels.dealEndDay[hotelIndex] != day) return false;
+    hotels.flags[hotelIndex] &= ~HOTEL_DEAL;
+    hotels.dealPercent[hotelIndex] = 0;
+    bitmapSet(facets.deal, hotelIndex, false);
+    return true;
 }
+//Start about as many deals as end each day, appending the hotels to out
+void startNewDeals(vector<int>& out) {
+    //One in five hotels on a deal at any time, deals last about a week
+    int newDeals = hotelCount / (5 * (DEAL_MIN_DAYS + DEAL_MAX_DAYS) / 2);
+    if (newDeals == 0 && hotelCount > 0 && rand() % 2 == 0) newDeals = 1;
+    for (int k = 0; k < newDeals; k++) {
+        int h = rand() % hotelCount;
+        if (hotels.flags[h] & HOTEL_DEAL) continue;
+        startHotelDeal(h);
+        bitmapSet(facets.deal, h, true);
+        out.push_back(h);
+    }
+}
+
+bool catalogColumnFits(unsigned int offset, size_t bytes, size_t fileSize, size_t alignment) {
+    return offset % alignment == 0 && offset <= fileSize && bytes <= fileSize - offset;
+}
+//Load the binary catalog. The static columns are used in place from the
+//mapping, only the live price / flag columns are allocated.
+bool loadCatalogFile(const char* path) {
+    MappedFile file;
+    if (!mapFile(path, file)) return false;
+    //Version 1 headers end before roomCountOffset
+    const size_t version1HeaderBytes = offsetof(CatalogFileHeader, roomCountOffset);
+    CatalogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    bool ok = file.size >= version1HeaderBytes;
+    if (ok) {
+        memcpy(&header, file.data, version1HeaderBytes);
+        ok = header.magic == CATALOG_MAGIC && (header.version == 1 || header.version == CATALOG_VERSION);
+    }
+    if (ok && header.version >= 2) {
+        ok = file.size >= sizeof(header);
+        if (ok) memcpy(&header, file.data, sizeof(header));
+    }
+    if (ok) {
+        size_t n = header.hotelCount;
+        ok = header.fileSize == file.size &&
+             (header.version < 2 || catalogColumnFits(header.roomCountOffset, n * sizeof(unsigned short), file.size, 2)) &&
+             catalogColumnFits(header.basePriceOffset, n * sizeof(float), file.size, 4) &&
+             catalogColumnFits(header.ratingOffset, n * sizeof(float), file.size, 4) &&
+             catalogColumnFits(header.nameOffsetOffset, (n + 1) * sizeof(unsigned int), file.size, 4) &&
+             catalogColumnFits(header.cityIdOffset, n, file.size, 1) &&
+             catalogColumnFits(header.categoryIdOffset, n, file.size, 1) &&
+             catalogColumnFits(header.amenityOffset, n, file.size, 1) &&
+             catalogColumnFits(header.nameDataOffset, header.nameBytes, file.size, 1);
+    }
+    if (ok) {
+        //IDs and name offsets must stay inside their tables
+        const unsigned char* cityIds = file.data + header.cityIdOffset;
+        const unsigned char* categoryIds = file.data + header.categoryIdOffset;
+        const unsigned int* nameOffsets = (const unsigned int*)(file.data + header.nameOffsetOffset);
+        ok = nameOffsets[0] == 0 && nameOffsets[header.hotelCount] == header.nameBytes;
+        for (unsigned int i = 0; ok && i < header.hotelCount; i++) {
+            ok = cityIds[i] < MAX_CITIES && categoryIds[i] < MAX_CATEGORIES &&
+                 nameOffsets[i] <= nameOffsets[i + 1];
+        }
+    }
+    if (!ok) {
+        unmapFile(file);
+        return false;
+    }
+
+    unmapFile(catalogFile);
+    catalogFile = file;
+    clearNameIndex();
+    priceIndexBuilt = false;
+    hotels = HotelCatalog();
+    hotelCount = (int)header.hotelCount;
+    hotels.basePrice = (const float*)(file.data + header.basePriceOffset);
+    hotels.rating = (const float*)(file.data + header.ratingOffset);
+    hotels.cityId = file.data + header.cityIdOffset;
+    hotels.categoryId = file.data + header.categoryIdOffset;
+    hotels.nameOffset = (const unsigned int*)(file.data + header.nameOffsetOffset);
+    hotels.nameData = (const char*)(file.data + header.nameDataOffset);
+    if (header.version >= 2) {
+        hotels.roomCount = (const unsigned short*)(file.data + header.roomCountOffset);
+    } else {
+        hotels.ownRoomCount.resize(hotelCount);
+        for (int i = 0; i < hotelCount; i++) hotels.ownRoomCount[i] = (unsigned short)CATEGORY_ROOMS[hotels.categoryId[i]];
+        hotels.roomCount = hotels.ownRoomCount.data();
+    }
+
+    const unsigned char* amenities = file.data + header.amenityOffset;
+    hotels.currentPrice.assign(hotels.basePrice, hotels.basePrice + hotelCount);
+    hotels.dealPercent.assign(hotelCount, 0.0f);
+    hotels.dealEndDay.assign(hotelCount, 0);
+    hotels.flags.resize(hotelCount);
+    for (int i = 0; i < hotelCount; i++) {
+        hotels.flags[i] = (amenities[i] & (HOTEL_WIFI | HOTEL_POOL)) | HOTEL_ACTIVE;
+    }
+    buildHotelKeyIndex();
+    return true;
+}
+//Write the current catalog in the binary format read by loadCatalogFile
+bool writeCatalogFile(const char* path) {
+    size_t n = (size_t)hotelCount;
+    CatalogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CATALOG_MAGIC;
+    header.version = CATALOG_VERSION;
+    header.hotelCount = (unsigned int)n;
+    header.nameBytes = hotels.nameOffset[n];
+    size_t offset = sizeof(header);
+    header.basePriceOffset = (unsigned int)offset;   offset += n * sizeof(float);
+    header.ratingOffset = (unsigned int)offset;      offset += n * sizeof(float);
+    header.nameOffsetOffset = (unsigned int)offset;  offset += (n + 1) * sizeof(unsigned int);
+    header.roomCountOffset = (unsigned int)offset;   offset += n * sizeof(unsigned short);
+    header.cityIdOffset = (unsigned int)offset;      offset += n;
+    header.categoryIdOffset = (unsigned int)offset;  offset += n;
+    header.amenityOffset = (unsigned int)offset;     offset += n;
+    size_t padding = (4 - offset % 4) % 4;
+    offset += padding;
+    header.nameDataOffset = (unsigned int)offset;    offset += header.nameBytes;
+    if (offset > 0xFFFFFFFFu) return false;
+    header.fileSize = (unsigned int)offset;
 
+    vector<unsigned char> amenities(n);
+    for (size_t i = 0; i < n; i++) amenities[i] = hotels.flags[i] & (HOTEL_WIFI | HOTEL_POOL);
+    const char zeros[4] = {0, 0, 0, 0};
+
+    ofstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)hotels.basePrice, n * sizeof(float));
+    file.write((const char*)hotels.rating, n * sizeof(float));
+    file.write((const char*)hotels.nameOffset, (n + 1) * sizeof(unsigned int));
+    file.write((const char*)hotels.roomCount, n * sizeof(unsigned short));
+    file.write((const char*)hotels.cityId, n);
+    file.write((const char*)hotels.categoryId, n);
+    file.write((const char*)amenities.data(), n);
+    file.write(zeros, padding);
+    file.write(hotels.nameData, header.nameBytes);
+    return file.good();
+}
+//Split one CSV line into fields, a field may be wrapped in double quotes
+int splitCsvLine(const string& line, string fields[], int maxFields) {
+    int count = 0;
+    string field = "";
+    bool inQuotes = false;
+    for (int i = 0; i < (int)line.length(); i++) {
+        char c = line[i];
+        if (inQuotes) {
+            if (c == '"' && i + 1 < (int)line.length() && line[i + 1] == '"') {
+                field += '"';
+                i++;
+            } else if (c == '"') {
+                inQuotes = false;
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            inQuotes = true;
+        } else if (c == ',') {
+            if (count < maxFields) fields[count] = field;
+            count++;
+            field = "";
+        } else if (c != '\r') {
+            field += c;
+        }
+    }
+    if (count < maxFields) fields[count] = field;
+    return count + 1;
+}
+bool parseCsvFloat(const string& text, float& value) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    value = strtof(text.c_str(), &end);
+    return end != nullptr && *end == '\0';
+}
+//CSV columns: name,city,category,price,rating,pool[,wifi[,rooms]]  (pool/wifi are 0 or 1)
+//Usage: musafir --convert-catalog hotels.csv musafir_hotels.bin
+int convertCatalogCsv(const char* csvPath, const char* binPath) {
+    ifstream in(csvPath);
+    if (!in.is_open()) {
+        printf("Cannot open %s\n", csvPath);
+        return 1;
+    }
+    clearCatalog();
+    string line;
+    string fields[8];
+    int lineNumber = 0;
+    int skipped = 0;
+    while (getline(in, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#' || line == "\r") continue;
+        int fieldCount = splitCsvLine(line, fields, 8);
+        if (lineNumber == 1 && containsIgnoreCase(fields[0], "name")) continue;  // header row
+
+        int cityId = fieldCount >= 6 ? findCityId(fields[1]) : -1;
+        int categoryId = fieldCount >= 6 ? findCategoryId(fields[2]) : -1;
+        float price = 0, rating = 0;
+        float rooms = categoryId != -1 ? (float)CATEGORY_ROOMS[categoryId] : 0;
+        bool ok = fieldCount >= 6 && fieldCount <= 8 && !fields[0].empty() &&
+                  cityId != -1 && categoryId != -1 &&
+                  parseCsvFloat(fields[3], price) && parseCsvFloat(fields[4], rating) && price > 0 &&
+                  (fieldCount < 8 || (parseCsvFloat(fields[7], rooms) && rooms >= 1 && rooms <= 65535));
+        if (!ok) {
+            printf("Skipping line %d: %s\n", lineNumber, line.c_str());
+            skipped++;
+            continue;
+        }
+        unsigned char amenities = 0;
+        if (fields[5] == "1") amenities |= HOTEL_POOL;
+        if (fieldCount < 7 || fields[6] == "1") amenities |= HOTEL_WIFI;
+        appendHotel(fields[0], cityId, categoryId, price, rating, amenities, (int)rooms);
+    }
+    if (!writeCatalogFile(binPath)) {
+        printf("Cannot write %s\n", binPath);
+        return 1;
+    }
+    printf("Wrote %d hotels to %s (%d lines skipped)\n", hotelCount, binPath, skipped);
+    return 0;
+}
+
+int rollWeatherType() {
+    // Random weather: 20% rain, 15% festival, 65% normal
+    int chance = rand() % 100;
+    if (chance < 20) return 1;
+    if (chance < 35) return 2;
+    return 0;
+}
+float weatherMultiplier(int type) {
+    if (type == 1) return MIN_WEATHER_MULTIPLIER;
+    if (type == 2) return MAX_WEATHER_MULTIPLIER;
+    return 1.0f;
+}
+int forecastType(int cityId, DayNumber day) {
+    return priceCalendar.weatherType[cityId][day % PRICE_CALENDAR_DAYS];
+}
+//Sum of the forecast multipliers for the days before `day`, valid from today
+//up to the end of the forecast
+double forecastSumBefore(int cityId, DayNumber day) {
+    return priceCalendar.multiplierSum[cityId][day % (PRICE_CALENDAR_DAYS + 1)];
+}
+void rollForecastDay(int cityId, DayNumber day) {
+    int type = rollWeatherType();
+    priceCalendar.weatherType[cityId][day % PRICE_CALENDAR_DAYS] = (unsigned char)type;
+    vector<double>& sum = priceCalendar.multiplierSum[cityId];
+    sum[(day + 1) % (PRICE_CALENDAR_DAYS + 1)] = sum[day % (PRICE_CALENDAR_DAYS + 1)] + weatherMultiplier(type);
+}
+//Today's weather comes from the forecast, returns true if the multiplier changed
+bool setWeatherFromForecast(int index) {
+    Weather w;
+    w.cityId = weatherData[index].cityId;
+    w.type = forecastType(w.cityId, appDate);
+    w.priceMultiplier = weatherMultiplier(w.type);
+    bool changed = w.priceMultiplier != weatherData[index].priceMultiplier;
+    weatherData[index] = w;
+    return changed;
+}
 void initializeWeather() {
     weatherCount = 0;
+    priceCalendar.firstDay = appDate;
     for (int i = 0; i < MAX_CITIES; i++) {
-        Weather w;
-        w.city = CITIES[i];
-        // Random weather: 20% rain, 15% festival, 65% normal
-        int chance = rand() % 100;
-        if (chance < 20) {
-            w.type = 1;
-            w.priceMultiplier = 0.85f;
-        } else if (chance < 35) {
-            w.type = 2;
-            w.priceMultiplier = 1.15f;
-        } else {
-            w.type = 0;
-            w.priceMultiplier = 1.0f;
-        }
+        priceCalendar.weatherType[i].assign(PRICE_CALENDAR_DAYS, 0);
+        priceCalendar.multiplierSum[i].assign(PRICE_CALENDAR_DAYS + 1, 0.0);
+        for (int d = 0; d < PRICE_CALENDAR_DAYS; d++) rollForecastDay(i, appDate + d);
         if (weatherCount < MAX_CITIES) {
-        weatherData[weatherCount] = w;
+        weatherData[weatherCount].cityId = i;
+        weatherData[weatherCount].priceMultiplier = 0;
+        setWeatherFromForecast(weatherCount);
         weatherCount++;
 		}
     }
 }
-int getWeatherIndexForCity(string city){//Find weather data for a city. Returns the index in weatherData array.
+//Weather change events for every day the forecast multiplier moves
+void scheduleWeatherChanges() {
+    for (int c = 0; c < MAX_CITIES; c++) {
+        for (int d = 1; d < PRICE_CALENDAR_DAYS; d++) {
+            DayNumber day = priceCalendar.firstDay + d;
+            if (forecastType(c, day) != forecastType(c, day - 1)) scheduleEvent(day, EVENT_WEATHER, c);
+        }
+    }
+}
+//Drop yesterday from the forecast and roll a new last day
+void extendForecast() {
+    priceCalendar.firstDay = appDate;
+    DayNumber newDay = appDate + PRICE_CALENDAR_DAYS - 1;
+    for (int c = 0; c < MAX_CITIES; c++) {
+        rollForecastDay(c, newDay);
+        if (forecastType(c, newDay) != forecastType(c, newDay - 1)) scheduleEvent(newDay, EVENT_WEATHER, c);
+    }
+}
+bool applyForecastWeather(int cityId) {
+    for (int i = 0; i < weatherCount; i++) {
+        if (weatherData[i].cityId == cityId) return setWeatherFromForecast(i);
+    }
+    return false;
+}
+//Sum of the city's weather multipliers over days [first, last) from today,
+//days past the forecast count as normal weather
+double weatherMultiplierSum(int cityId, int first, int last) {
+    if (last <= first) return 0;
+    int a = min(first, PRICE_CALENDAR_DAYS);
+    int b = min(last, PRICE_CALENDAR_DAYS);
+    double forecast = forecastSumBefore(cityId, appDate + b) - forecastSumBefore(cityId, appDate + a);
+    return forecast + (last - first) - (b - a);
+}
+//Nightly price the repricing kernel would give the hotel on a day from today
+float forecastNightPrice(int hotelIndex, int day) {
+    int cityId = hotels.cityId[hotelIndex];
+    float price = hotels.basePrice[hotelIndex];
+    price *= (day < PRICE_CALENDAR_DAYS) ? weatherMultiplier(forecastType(cityId, appDate + day)) : 1.0f;
+    if ((hotels.flags[hotelIndex] & HOTEL_DEAL) && day < hotels.dealEndDay[hotelIndex] - appDate) {
+        price *= 1.0f - (hotels.dealPercent[hotelIndex] / 100.0f);
+    }
+    return clamp(price, 500.0f, 200000.0f);
+}
+//Room price for nights [firstNight, firstNight + nights) counted from today,
+//before the mode multiplier. Uses the forecast weather and the running deal.
+float quoteStay(int hotelIndex, int firstNight, int nights) {
+    if (nights <= 0) return 0;
+    if (firstNight < 0) firstNight = 0;
+    int lastNight = firstNight + nights;
+    float base = hotels.basePrice[hotelIndex];
+    float dealFactor = 1.0f;
+    int dealEnd = firstNight;
+    if (hotels.flags[hotelIndex] & HOTEL_DEAL) {
+        dealFactor = 1.0f - (hotels.dealPercent[hotelIndex] / 100.0f);
+        dealEnd = max(firstNight, min(lastNight, hotels.dealEndDay[hotelIndex] - appDate));
+    }
+    //The price clamp only matters at the extremes, walk the nights there
+    if (base * MIN_WEATHER_MULTIPLIER * dealFactor < 500.0f || base * MAX_WEATHER_MULTIPLIER > 200000.0f) {
+        float total = 0;
+        for (int d = firstNight; d < lastNight; d++) total += forecastNightPrice(hotelIndex, d);
+        return total;
+    }
+    int cityId = hotels.cityId[hotelIndex];
+    double dealDays = weatherMultiplierSum(cityId, firstNight, dealEnd);
+    double otherDays = weatherMultiplierSum(cityId, dealEnd, lastNight);
+    return (float)(base * (dealDays * dealFactor + otherDays));
+}
+int getWeatherIndexForCity(int cityId){//Find weather data for a city. Returns the index in weatherData array.
     for (int i = 0; i < weatherCount; i++){
-        if (weatherData[i].city == city){
+        if (weatherData[i].cityId == cityId){
             return i;  //Found it at position i
         }
     }
     return -1;  //Not found
 }
-void updateHotelPrices() {
-    for (int i = 0; i < hotelCount; i++) {
-        Hotel& h = hotels[i];
-        if (!h.isActive) continue;
-        //Start with base price
-        float price = h.basePrice;
-        //Apply weather effects
-        int weatherIndex = getWeatherIndexForCity(h.city);
-        if (weatherIndex != -1) {
-            //Found weather data for this city, apply the multiplier
-            price *= weatherData[weatherIndex].priceMultiplier;
-        }
-        //Apply deals
-        if (h.hasDeal && h.dealPercent > 0) {
-            float discount = 1.0f - (h.dealPercent / 100.0f);
-            price *= discount;
+//Pricing kernels: price = clamp(base * city weather multiplier * deal factor).
+//Every version does the same float operations in the same order, so they
+//give bit-identical prices; the SIMD ones just do 4 or 8 hotels at a time.
+typedef void (*RepriceKernel)(const float* basePrice, const unsigned char* cityId, const float* dealPercent,
+                              const float* cityMultiplier, float* outPrice, int count);
+void repriceScalar(const float* basePrice, const unsigned char* cityId, const float* dealPercent,
+                   const float* cityMultiplier, float* outPrice, int count) {
+    for (int i = 0; i < count; i++) {
+        float price = basePrice[i];
+        price *= cityMultiplier[cityId[i]];
+        //dealPercent is 0 without a deal, which makes the factor exactly 1
+        price *= 1.0f - (dealPercent[i] / 100.0f);
+        outPrice[i] = clamp(price, 500.0f, 200000.0f);
+    }
+}
+#ifdef MUSAFIR_X86
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+void repriceSse(const float* basePrice, const unsigned char* cityId, const float* dealPercent,
+                const float* cityMultiplier, float* outPrice, int count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 hundred = _mm_set1_ps(100.0f);
+    const __m128 low = _mm_set1_ps(500.0f);
+    const __m128 high = _mm_set1_ps(200000.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 multiplier = _mm_set_ps(cityMultiplier[cityId[i + 3]], cityMultiplier[cityId[i + 2]],
+                                       cityMultiplier[cityId[i + 1]], cityMultiplier[cityId[i]]);
+        __m128 price = _mm_mul_ps(_mm_loadu_ps(basePrice + i), multiplier);
+        __m128 factor = _mm_sub_ps(one, _mm_div_ps(_mm_loadu_ps(dealPercent + i), hundred));
+        price = _mm_mul_ps(price, factor);
+        _mm_storeu_ps(outPrice + i, _mm_max_ps(_mm_min_ps(price, high), low));
+    }
+    repriceScalar(basePrice + i, cityId + i, dealPercent + i, cityMultiplier, outPrice + i, count - i);
+}
+TARGET_AVX2
+void repriceAvx2(const float* basePrice, const unsigned char* cityId, const float* dealPercent,
+                 const float* cityMultiplier, float* outPrice, int count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 hundred = _mm256_set1_ps(100.0f);
+    const __m256 low = _mm256_set1_ps(500.0f);
+    const __m256 high = _mm256_set1_ps(200000.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i ids = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(cityId + i)));
+        __m256 multiplier = _mm256_i32gather_ps(cityMultiplier, ids, 4);
+        __m256 price = _mm256_mul_ps(_mm256_loadu_ps(basePrice + i), multiplier);
+        __m256 factor = _mm256_sub_ps(one, _mm256_div_ps(_mm256_loadu_ps(dealPercent + i), hundred));
+        price = _mm256_mul_ps(price, factor);
+        _mm256_storeu_ps(outPrice + i, _mm256_max_ps(_mm256_min_ps(price, high), low));
+    }
+    repriceScalar(basePrice + i, cityId + i, dealPercent + i, cityMultiplier, outPrice + i, count - i);
+}
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    if (!osSavesAvx) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();  // may run from a static initializer
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+//Pick the fastest kernel this CPU supports, once
+RepriceKernel selectRepriceKernel(const char*& name) {
+#ifdef MUSAFIR_X86
+    if (cpuHasAvx2()) {
+        name = "AVX2";
+        return repriceAvx2;
+    }
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    name = "SSE2";
+    return repriceSse;
+#endif
+#endif
+    name = "scalar";
+    return repriceScalar;
+}
+const char* repriceKernelName = "";
+RepriceKernel repriceKernel = selectRepriceKernel(repriceKernelName);
+//Run every kernel this CPU supports on the same random hotels and check the
+//prices are bit-identical to the scalar ones, including the leftover tails.
+//Usage: musafir --self-test
+int runSelfTest() {
+    vector<pair<const char*, RepriceKernel>> kernels;
+#ifdef MUSAFIR_X86
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    kernels.push_back(make_pair("SSE2", (RepriceKernel)repriceSse));
+#endif
+    if (cpuHasAvx2()) kernels.push_back(make_pair("AVX2", (RepriceKernel)repriceAvx2));
+#endif
+    mt19937 rng(9);
+    const int HOTELS = 4099;  // not a multiple of 4 or 8
+    vector<float> basePrice(HOTELS), dealPercent(HOTELS);
+    vector<unsigned char> cityId(HOTELS);
+    for (int i = 0; i < HOTELS; i++) {
+        //Some prices land outside 500..200000 so the clamp is exercised too
+        basePrice[i] = 100.0f + (float)(rng() % 25000000) / 100.0f;
+        cityId[i] = (unsigned char)(rng() % MAX_CITIES);
+        dealPercent[i] = (rng() % 3 == 0) ? (float)(10 + rng() % 21) : 0.0f;
+    }
+    float cityMultiplier[MAX_CITIES];
+    int failures = 0;
+    for (int round = 0; round < 20; round++) {
+        for (int c = 0; c < MAX_CITIES; c++) cityMultiplier[c] = 0.5f + (float)(rng() % 1500) / 1000.0f;
+        //Odd offsets and lengths cover the unaligned loads and scalar tails
+        int first = rng() % 16;
+        int count = (round == 0) ? 0 : (int)(rng() % (HOTELS - first));
+        vector<float> expected(count + 1), actual(count + 1);
+        repriceScalar(&basePrice[first], &cityId[first], &dealPercent[first], cityMultiplier, expected.data(), count);
+        for (int k = 0; k < (int)kernels.size(); k++) {
+            kernels[k].second(&basePrice[first], &cityId[first], &dealPercent[first], cityMultiplier,
+                              actual.data(), count);
+            if (memcmp(expected.data(), actual.data(), count * sizeof(float)) != 0) {
+                printf("FAIL: %s prices differ from scalar (hotels %d..%d)\n", kernels[k].first, first, first + count);
+                failures++;
+            }
         }
-        //Keep price in reasonable range
-        h.currentPrice = clamp(price, 500.0, 200000.0);
     }
+    printf("Pricing kernels checked against scalar:");
+    for (int k = 0; k < (int)kernels.size(); k++) printf(" %s", kernels[k].first);
+    if (kernels.empty()) printf(" none available");
+    printf(", in use: %s\n", repriceKernelName);
+    printf(failures == 0 ? "OK\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
 }
-void advanceDay() {
-    appDay++;
-    if (appDay > 30) {
-        appDay = 1;
-        appMonth++;
-        if (appMonth > 12) {
-            appMonth = 1;
-            appYear++;
+vector<float> repricedScratch;
+
+//City multipliers looked up once instead of per hotel
+void getCityMultipliers(float cityMultiplier[]) {
+    for (int c = 0; c < MAX_CITIES; c++) {
+        int weatherIndex = getWeatherIndexForCity(c);
+        cityMultiplier[c] = (weatherIndex != -1) ? weatherData[weatherIndex].priceMultiplier : 1.0f;
+    }
+}
+//Reprice hotels [first, first + count) and record the ones whose price moved.
+//A hotel repriced twice only shows up once since its price already matches.
+void repriceRange(int first, int count, const float cityMultiplier[], vector<int>& changed,
+                  vector<float>& oldPrices) {
+    if (count <= 0) return;
+    if ((int)repricedScratch.size() < count) repricedScratch.resize(count);
+    repriceKernel(hotels.basePrice + first, hotels.cityId + first, hotels.dealPercent.data() + first,
+                  cityMultiplier, repricedScratch.data(), count);
+    for (int k = 0; k < count; k++) {
+        int i = first + k;
+        float price = repricedScratch[k];
+        if (price == hotels.currentPrice[i] || !(hotels.flags[i] & HOTEL_ACTIVE)) continue;
+        changed.push_back(i);
+        oldPrices.push_back(hotels.currentPrice[i]);
+        hotels.currentPrice[i] = price;
+    }
+}
+void updateHotelPrices() {
+    float cityMultiplier[MAX_CITIES];
+    getCityMultipliers(cityMultiplier);
+    vector<int> changed;
+    vector<float> oldPrices;
+    repriceRange(0, hotelCount, cityMultiplier, changed, oldPrices);
+    updatePriceIndex(changed, oldPrices);
+    priceEpoch++;
+}
+//Reprice only the hotels in the given cities plus the given hotels
+void repriceHotels(const vector<int>& changedCities, const vector<int>& changedHotels) {
+    if (changedCities.empty() && changedHotels.empty()) return;
+    float cityMultiplier[MAX_CITIES];
+    getCityMultipliers(cityMultiplier);
+    vector<int> changed;
+    vector<float> oldPrices;
+    for (int k = 0; k < (int)changedCities.size(); k++) {
+        const vector<CityRun>& runs = cityRuns[changedCities[k]];
+        for (int r = 0; r < (int)runs.size(); r++) {
+            repriceRange(runs[r].first, runs[r].count, cityMultiplier, changed, oldPrices);
         }
     }
-    initializeWeather();
-    updateHotelPrices();
+    for (int k = 0; k < (int)changedHotels.size(); k++) {
+        repriceRange(changedHotels[k], 1, cityMultiplier, changed, oldPrices);
+    }
+    updatePriceIndex(changed, oldPrices);
+    //Deal flags changed even if no price did
+    priceEpoch++;
 }
-void initializeHotels() {
-    hotelCount = 0;
+//Weather changes, deal ends and checkouts for the new day land in
+//dueEvents, the main loop hands them to runDueEvents
+void advanceDay() {
+    lock_guard<DayLock> day(dayLock);
+    appDate++;
+    pruneRoomInventory();
+    extendForecast();
+    advanceTimingWheel();
+    vector<int> newDeals;
+    startNewDeals(newDeals);
+    repriceHotels(vector<int>(), newDeals);
+}
+void addBuiltInHotels() {
     //Islamabad
     addHotel("Serena Hotel", "Islamabad", "Luxury", 25000, 4.8f, true);
     addHotel("Marriott Islamabad", "Islamabad", "Luxury", 22000, 4.7f, true);
@@ -707,168 +2790,1062 @@ void initializeHotels() {
     addHotel("Kashmir Continental", "Muzaffarabad", "Business", 5000, 3.9f, false);
     addHotel("Red Onion Hotel", "Muzaffarabad", "Budget", 3000, 3.7f, false);
     addHotel("Neelum View", "Muzaffarabad", "Resort", 6000, 4.0f, false);
-
+}
+//Schedule everything again from the current weather forecast, deals and bookings
+void rebuildSchedule() {
+    resetTimingWheel(appDate);
+    scheduleWeatherChanges();
+    for (int i = 0; i < hotelCount; i++) {
+        if (hotels.flags[i] & HOTEL_DEAL) scheduleEvent(hotels.dealEndDay[i], EVENT_DEAL_END, i);
+    }
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        int slot = bookingStore.live[k];
+        scheduleEvent(bookingAt(slot).checkOut, EVENT_CHECKOUT, slot);
+    }
+}
+void initializeHotels() {
+    //Use the binary catalog file when present, otherwise the built-in list
+    if (!loadCatalogFile(CATALOG_FILE)) {
+        unmapFile(catalogFile);
+        clearCatalog();
+        addBuiltInHotels();
+    }
+    buildCityRuns();
+    buildNameIndex();
+    rollHotelDeals();
     // Update prices based on weather after initialization
     updateHotelPrices();
+    buildPriceIndex();
+    buildBookingIndexes();
+    buildRoomInventory();
+    rebuildSchedule();
 }
-//save file
-void saveGame() {
-    ofstream file("musafir_save.txt");
-    if (!file.is_open()) return;
-    
-    file << user.name << "\n";
-    file << user.totalBookings << "\n";
-    file << user.totalSpent << "\n";
-    file << user.placesVisited << "\n";
-    file << user.maxBudget << "\n";
-    file << (user.budgetMode ? 1 : 0) << "\n";
-    file << user.level << "\n";
-	//Save planner
-    file << (planner.enabled ? 1 : 0) << "\n";
-    file << planner.totalBudget << "\n";
-    file << planner.plannedTrips << "\n";
-    file << planner.spentInPlan << "\n";
-    file << planner.tripsInPlan << "\n";
-    
-    // Save notes
-    file << noteCount << "\n";
-    for (int i = 0; i < noteCount; i++) {
-        file << plannerNotes[i] << "\n";
-    }
+//Binary snapshot of the traveler, read back by decodeSave
+string encodeSave(unsigned long long journalSeq) {
+    vector<unsigned int> stringOffsets(1, 0);
+    string stringData;
+    unordered_map<string, unsigned int> stringIds;
+    auto intern = [&](const string& text) {
+        auto it = stringIds.find(text);
+        if (it != stringIds.end()) return it->second;
+        unsigned int id = (unsigned int)stringOffsets.size() - 1;
+        stringData += text;
+        stringOffsets.push_back((unsigned int)stringData.size());
+        stringIds[text] = id;
+        return id;
+    };
+    SaveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SAVE_MAGIC;
+    header.version = SAVE_VERSION;
+    header.headerBytes = sizeof(header);
+    header.journalSeq = journalSeq;
+    header.lastBookingId = lastBookingId.load();
+    header.nameString = intern(user.name);
+    header.flags = (user.budgetMode ? SAVE_BUDGET_MODE : 0) | (planner.enabled ? SAVE_PLANNER : 0) |
+                   (badges.frequentTraveler ? SAVE_FREQUENT_TRAVELER : 0) |
+                   (badges.budgetMaster ? SAVE_BUDGET_MASTER : 0) | (badges.explorer ? SAVE_EXPLORER : 0);
+    header.totalBookings = user.totalBookings;
+    header.totalSpent = user.totalSpent;
+    header.placesVisited = user.placesVisited;
+    header.maxBudget = user.maxBudget;
+    header.level = user.level;
+    header.destinationsTravelled = destinationsTravelled;
+    header.plannerBudget = planner.totalBudget;
+    header.plannedTrips = planner.plannedTrips;
+    header.spentInPlan = planner.spentInPlan;
+    header.tripsInPlan = planner.tripsInPlan;
 
+    vector<SavedBooking> bookings(bookingStore.live.size());
+    for (size_t k = 0; k < bookings.size(); k++) {
+        const Booking& b = bookingAt(bookingStore.live[k]);
+        SavedBooking& saved = bookings[k];
+        memset(&saved, 0, sizeof(saved));
+        saved.bookingId = b.bookingId;
+        saved.hotelName = intern(b.hotelName);
+        saved.city = intern(b.city);
+        saved.checkIn = b.checkIn;
+        saved.nights = b.nights;
+        saved.guests = b.guests;
+        saved.rooms = b.rooms;
+        saved.totalCost = b.totalCost;
+    }
+    vector<unsigned int> notes;
+    for (int i = 0; i < noteCount; i++) notes.push_back(intern(plannerNotes[i]));
+    vector<unsigned int> visited;
+    for (int i = 0; i < visitedHotelCount; i++) {
+        visited.push_back(intern(visitedHotelNames[i]));
+        visited.push_back(intern(visitedHotelCities[i]));
+    }
 
-	// Save achievements
-    file << (badges.frequentTraveler ? 1 : 0) << "\n";
-    file << (badges.budgetMaster ? 1 : 0) << "\n";
-    file << (badges.explorer ? 1 : 0) << "\n";
-    
-    // Save destinations travelled
-    file << destinationsTravelled << "\n";
+    header.bookingCount = (unsigned int)bookings.size();
+    header.noteCount = (unsigned int)notes.size();
+    header.visitedCount = (unsigned int)visited.size() / 2;
+    header.stringCount = (unsigned int)stringOffsets.size() - 1;
+    header.stringBytes = (unsigned int)stringData.size();
+    size_t offset = sizeof(header);
+    header.bookingOffset = (unsigned int)offset;       offset += bookings.size() * sizeof(SavedBooking);
+    header.noteOffset = (unsigned int)offset;          offset += notes.size() * sizeof(unsigned int);
+    header.visitedOffset = (unsigned int)offset;       offset += visited.size() * sizeof(unsigned int);
+    header.stringOffsetOffset = (unsigned int)offset;  offset += stringOffsets.size() * sizeof(unsigned int);
+    header.stringDataOffset = (unsigned int)offset;    offset += stringData.size();
+    header.fileSize = (unsigned int)offset;
 
-	
-    file << visitedHotelCount << "\n";
-    for (int i = 0; i < visitedHotelCount; i++) {
-        file << visitedHotelNames[i] << "\n";
-        file << visitedHotelCities[i] << "\n";
+    string out((const char*)&header, sizeof(header));
+    out.reserve(offset);
+    out.append((const char*)bookings.data(), bookings.size() * sizeof(SavedBooking));
+    out.append((const char*)notes.data(), notes.size() * sizeof(unsigned int));
+    out.append((const char*)visited.data(), visited.size() * sizeof(unsigned int));
+    out.append((const char*)stringOffsets.data(), stringOffsets.size() * sizeof(unsigned int));
+    out += stringData;
+    header.dataChecksum = hashBytes(out.data() + sizeof(header), out.size() - sizeof(header));
+    header.headerChecksum = hashBytes((const char*)&header, sizeof(header));
+    memcpy(&out[0], &header, sizeof(header));
+    return out;
+}
+void syncFile(FILE* file) {
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+//Write a whole file through a synced temp file, so a crash leaves either
+//the old contents or the new ones. Returns false with the reason on failure.
+bool replaceFile(const string& path, const string& data, string& error) {
+    string tempFile = path + ".tmp";
+    FILE* file = fopen(tempFile.c_str(), "wb");
+    if (!file) {
+        error = "cannot create " + tempFile;
+        return false;
     }
-    
-    int activeBookings = 0;
-    for (int i = 0; i < bookingCount; i++) {
-        if (bookings[i].isActive) activeBookings++;
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    syncFile(file);
+    if (fclose(file) != 0 || !written) {
+        error = "cannot write " + tempFile;
+        return false;
+    }
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (rename(tempFile.c_str(), path.c_str()) != 0) {
+        error = "cannot replace " + path;
+        return false;
     }
-    file << activeBookings << "\n";
+    return true;
+}
+//Letters and digits are kept, any other byte becomes _ and two hex digits,
+//so every user key gets its own file name
+string profilePath(const string& userKey, const char* extension = ".bin") {
+    static const char HEX[] = "0123456789abcdef";
+    string path = string(PROFILE_DIR) + "/";
+    for (int i = 0; i < (int)userKey.length(); i++) {
+        unsigned char c = (unsigned char)userKey[i];
+        if (isalnum(c)) {
+            path += (char)c;
+        } else {
+            path += '_';
+            path += HEX[c >> 4];
+            path += HEX[c & 15];
+        }
+    }
+    return path + extension;
+}
+//Profiles used to be named after a 32-bit hash of the key, which two
+//travelers could share. Such a file is only used once its name is checked.
+string legacyProfilePath(const string& userKey, const char* extension = ".bin") {
+    return string(PROFILE_DIR) + "/" + to_string(hashString(userKey)) + extension;
+}
+bool fileExists(const string& path) {
+    ifstream file(path.c_str());
+    return file.is_open();
+}
+bool legacyProfileIsFor(const string& userKey);
+//Write a parked traveler's profile, older files of theirs go once it is replaced
+bool writeProfileFile(const string& userKey, const string& data, string& error) {
+#ifdef _WIN32
+    _mkdir(PROFILE_DIR);
+#else
+    mkdir(PROFILE_DIR, 0755);
+#endif
+    if (!replaceFile(profilePath(userKey), data, error)) return false;
+    remove(profilePath(userKey, ".txt").c_str());
+    if (legacyProfileIsFor(userKey)) {
+        remove(legacyProfilePath(userKey).c_str());
+        remove(legacyProfilePath(userKey, ".txt").c_str());
+    }
+    saves.performed++;
+    return true;
+}
+//Write a snapshot, then drop the journal records it covers. The snapshot
+//holds the number of the last record it includes, so a crash in between
+//replays nothing twice. Returns false with the reason on failure.
+bool writeSnapshot(const string& data, unsigned long long seq, string& error) {
+    lock_guard<mutex> flush(journal.flushLock);
+    if (!replaceFile(SAVE_FILE, data, error)) return false;
+    remove(TEXT_SAVE_FILE);  // replaced by the binary snapshot
+    saves.performed++;
+    //Records committed after the snapshot was taken stay in the journal
+    ifstream log(JOURNAL_FILE);
+    string kept, line;
+    int dropped = 0;
+    while (getline(log, line) && !log.eof()) {
+        if (strtoull(line.c_str(), NULL, 10) > seq) kept += line + "\n";
+        else dropped++;
+    }
+    log.close();
+    string tempLog = string(JOURNAL_FILE) + ".tmp";
+    FILE* out = fopen(tempLog.c_str(), "wb");
+    if (!out) return true;
+    fwrite(kept.data(), 1, kept.size(), out);
+    syncFile(out);
+    fclose(out);
+#ifdef _WIN32
+    remove(JOURNAL_FILE);
+#endif
+    rename(tempLog.c_str(), JOURNAL_FILE);
+    lock_guard<mutex> lock(journal.lock);
+    journal.records = max(journal.records - dropped, 0);
+    return true;
+}
+//Tabs and line breaks separate journal fields and records
+string journalText(const string& text) {
+    string clean = text;
+    for (int i = 0; i < (int)clean.length(); i++) {
+        if (clean[i] == '\t' || clean[i] == '\n' || clean[i] == '\r') clean[i] = ' ';
+    }
+    return clean;
+}
+void appendJournal(const string& record) {
+    lock_guard<mutex> lock(journal.lock);
+    journal.lastSeq++;
+    journal.pending += to_string(journal.lastSeq) + "\t" + record + "\n";
+    journal.records++;
+}
+//Make every record appended so far durable. Whoever commits first writes
+//and syncs all pending records; callers whose records went out with it
+//return without touching the file.
+bool commitJournal() {
+    unsigned long long target;
+    {
+        lock_guard<mutex> lock(journal.lock);
+        target = journal.lastSeq;
+    }
+    lock_guard<mutex> flush(journal.flushLock);
+    if (journal.durableSeq >= target) return true;
+    string batch;
+    unsigned long long batchSeq;
+    {
+        lock_guard<mutex> lock(journal.lock);
+        batch.swap(journal.pending);
+        batchSeq = journal.lastSeq;
+        if (journal.records >= JOURNAL_COMPACT_RECORDS) journal.compactWanted = true;
+    }
+    FILE* file = fopen(JOURNAL_FILE, "ab");
+    bool written = file != NULL && fwrite(batch.data(), 1, batch.size(), file) == batch.size();
+    if (file) {
+        syncFile(file);
+        written = fclose(file) == 0 && written;
+    }
+    if (!written) {
+        //Keep the records for the next try
+        lock_guard<mutex> lock(journal.lock);
+        journal.pending.insert(0, batch);
+        return false;
+    }
+    journal.durableSeq = batchSeq;
+    saves.performed++;
+    return true;
+}
+void persistenceDone(bool ok, const string& error) {
+    lock_guard<mutex> lock(persistence.lock);
+    persistence.failed = !ok;
+    persistence.error = ok ? "" : error;
+}
+void persistenceLoop() {
+    unique_lock<mutex> lock(persistence.lock);
+    while (true) {
+        persistence.wake.wait(lock, [] {
+            return persistence.stopping || persistence.commitWanted || persistence.snapshotWanted ||
+                   !persistence.profileWrites.empty();
+        });
+        if (!persistence.commitWanted && !persistence.snapshotWanted && persistence.profileWrites.empty()) break;
+        bool commit = persistence.commitWanted;
+        bool snapshot = persistence.snapshotWanted;
+        string data;
+        data.swap(persistence.snapshotData);
+        map<string, string> profiles;
+        profiles.swap(persistence.profileWrites);
+        unsigned long long seq = persistence.snapshotSeq;
+        persistence.commitWanted = false;
+        persistence.snapshotWanted = false;
+        persistence.busy = true;
+        lock.unlock();
+        string error;
+        bool ok = true;
+        if (commit && !commitJournal()) {
+            ok = false;
+            error = string("cannot write ") + JOURNAL_FILE;
+        }
+        bool snapshotFailed = snapshot && !writeSnapshot(data, seq, error);
+        if (snapshotFailed) ok = false;
+        for (auto it = profiles.begin(); it != profiles.end(); ++it) {
+            if (!writeProfileFile(it->first, it->second, error)) ok = false;
+        }
+        persistenceDone(ok, error);
+        lock.lock();
+        if (snapshotFailed) persistence.lastSnapshot.clear();  // the next saveGame retries
+        persistence.busy = false;
+        if (!persistence.commitWanted && !persistence.snapshotWanted && persistence.profileWrites.empty()) {
+            persistence.idle.notify_all();
+        }
+    }
+}
+//Commit the journal in the background (right away when there is no worker)
+void dispatchJournalCommit() {
+    saves.waiting = false;
+    saves.firstRequest = -1;
+    if (!persistence.running) {
+        string error = string("cannot write ") + JOURNAL_FILE;
+        persistenceDone(commitJournal(), error);
+        return;
+    }
+    lock_guard<mutex> lock(persistence.lock);
+    persistence.commitWanted = true;
+    persistence.wake.notify_one();
+}
+//Ask for the journal to be committed, main thread only. The write waits
+//for pumpSaves, so a burst of changes shares one.
+void requestJournalCommit() {
+    saves.requested++;
+    saves.waiting = true;
+}
+//Called once a frame, sends the waiting commit once the window has passed
+void pumpSaves(double now) {
+    if (!saves.waiting) return;
+    if (saves.firstRequest < 0) saves.firstRequest = now;
+    //commitJournal writes nothing if every record is already on disk
+    if (now - saves.firstRequest >= saves.window) dispatchJournalCommit();
+}
+void startPersistence() {
+    persistence.running = true;
+    persistence.stopping = false;
+    persistence.worker = thread(persistenceLoop);
+}
+//Wait until everything asked for so far is on disk
+void flushPersistence() {
+    if (saves.waiting) dispatchJournalCommit();
+    unique_lock<mutex> lock(persistence.lock);
+    persistence.idle.wait(lock, [] {
+        return !persistence.busy && !persistence.commitWanted && !persistence.snapshotWanted &&
+               persistence.profileWrites.empty();
+    });
+}
+//Queue a parked traveler's profile, a newer one for the same traveler
+//replaces a queued one
+void queueProfileWrite(const string& userKey, const string& data) {
+    if (!persistence.running) {
+        string error;
+        bool ok = writeProfileFile(userKey, data, error);
+        persistenceDone(ok, error);
+        return;
+    }
+    lock_guard<mutex> lock(persistence.lock);
+    persistence.profileWrites[userKey] = data;
+    persistence.wake.notify_one();
+}
+//Finish the queued writes and stop the worker
+void stopPersistence() {
+    if (!persistence.running) return;
+    if (saves.waiting) dispatchJournalCommit();
+    {
+        lock_guard<mutex> lock(persistence.lock);
+        persistence.stopping = true;
+    }
+    persistence.wake.notify_one();
+    persistence.worker.join();
+    persistence.running = false;
+}
+//Capture the traveler and queue the snapshot, a newer one replaces a queued
+//one. Nothing is written if it matches the last snapshot.
+void saveGame() {
+    saves.requested++;
+    string data;
+    unsigned long long seq;
+    {
+        lock_guard<mutex> lock(accountMutex);
+        {
+            lock_guard<mutex> pending(journal.lock);
+            seq = journal.lastSeq;
+        }
+        data = encodeSave(seq);
+    }
+    journal.compactWanted = false;
+    //The snapshot covers any commit still waiting
+    if (saves.waiting) {
+        saves.waiting = false;
+        saves.firstRequest = -1;
+    }
+    if (!persistence.running) {
+        if (data == persistence.lastSnapshot) return;
+        string error;
+        bool ok = writeSnapshot(data, seq, error);
+        persistence.lastSnapshot = ok ? data : "";
+        persistenceDone(ok, error);
+        return;
+    }
+    lock_guard<mutex> lock(persistence.lock);
+    if (data == persistence.lastSnapshot) return;
+    persistence.lastSnapshot = data;
+    persistence.snapshotData.swap(data);
+    persistence.snapshotSeq = seq;
+    persistence.snapshotWanted = true;
+    persistence.wake.notify_one();
+}
+string persistenceStatus() {
+    string counts = " (" + to_string(saves.performed.load()) + " writes for " + to_string(saves.requested.load()) +
+                    " save requests)";
+    lock_guard<mutex> lock(persistence.lock);
+    if (saves.waiting || persistence.busy || persistence.commitWanted || persistence.snapshotWanted ||
+        !persistence.profileWrites.empty()) {
+        return "Saving..." + counts;
+    }
+    if (persistence.failed) return "Could not save: " + persistence.error;
+    return "All changes saved" + counts;
+}
+//Planner, budget and notes as they are now, each only if it changed since
+//it was last journaled for this traveler
+void journalSettings() {
+    string settings = "SETTINGS\t" + to_string(user.maxBudget) + "\t" + to_string(user.budgetMode ? 1 : 0) + "\t" +
+                      to_string(planner.enabled ? 1 : 0) + "\t" + to_string(planner.totalBudget) + "\t" +
+                      to_string(planner.plannedTrips) + "\t" + to_string(planner.spentInPlan) + "\t" +
+                      to_string(planner.tripsInPlan);
+    if (settings != journal.lastSettings) {
+        appendJournal(settings);
+        journal.lastSettings = settings;
+    }
+    string notes = "NOTES\t" + to_string(noteCount);
+    for (int i = 0; i < noteCount; i++) notes += "\t" + journalText(plannerNotes[i]);
+    if (notes != journal.lastNotes) {
+        appendJournal(notes);
+        journal.lastNotes = notes;
+    }
+}
+//Add to what the traveler spent. With withinBudget an amount that would
+//take it over maxBudget is refused; the check and the add are one
+//compare-and-swap, so booking calls need no lock for the budget.
+bool addSpent(float amount, bool withinBudget) {
+    float spent = user.totalSpent.load();
+    do {
+        if (withinBudget && user.maxBudget > 0 && spent + amount > user.maxBudget) return false;
+    } while (!user.totalSpent.compare_exchange_weak(spent, spent + amount));
+    return true;
+}
+//A new booking's effect on the traveler, shared by createBooking and replay.
+//The caller settles the spending.
+int addBookingRecord(const Booking& booking) {
+    int slot = allocBookingSlot();
+    bookingAt(slot) = booking;
+    hashInsert(bookingIdIndex, bookingIdHash(booking.bookingId), slot);
+    user.totalBookings++;
+    user.placesVisited++;
+	updateUserLevel();
+    updateTravelerScore();
+    updateAchievements();
 
-for (int i = 0; i < bookingCount; i++) {
-        const Booking& b = bookings[i];
-        if (!b.isActive) continue;
-        file << b.hotelName << "\n";
-        file << b.city << "\n";
-        file << b.bookingId << "\n";
-        file << b.checkInDate << "\n";
-        file << b.checkOutDate << "\n";
-        file << b.nights << "\n";
-        file << b.guests << "\n";
-        file << b.rooms << "\n";
-        file << b.totalCost << "\n";
-    }
-    
-    file.close();
+    //Track in planner
+    if (planner.enabled){
+        planner.spentInPlan += booking.totalCost;
+        planner.tripsInPlan++;
+	}
+    return slot;
+}
+//New dates and guests for a booking, shared by updateBooking and replay.
+//The caller settles the spending.
+void editBookingRecord(Booking& booking, DayNumber checkIn, int numNights, int numGuests, int rooms, float cost) {
+    booking.nights = numNights;
+    booking.guests = numGuests;
+    booking.rooms = rooms;
+    booking.totalCost = cost;
+    booking.checkIn = checkIn;
+    booking.checkOut = checkIn + numNights;
 }
 //functions for booking
-bool createBooking(int hotelIndex, int numNights, int numGuests) {
-    if (hotelIndex < 0 || hotelIndex >= hotelCount) return false;
-    if (bookingCount >= MAX_BOOKINGS) return false;
+//Book a stay, returns the booking's slot or -1 when rooms or budget run short
+int createBooking(int hotelIndex, DayNumber checkIn, int numNights, int numGuests) {
+    if (hotelIndex < 0 || hotelIndex >= hotelCount) return -1;
+    //appDate cannot move while this is held, so a stay never starts in the past
+    shared_lock<DayLock> day(dayLock);
+    if (checkIn < appDate) return -1;
     
-    Hotel& hotel = hotels[hotelIndex];
     int roomsNeeded = (numGuests + MAX_GUESTS_PER_ROOM - 1) / MAX_GUESTS_PER_ROOM;
-	float priceMultiplier = getPriceMultiplier(hotel);
-    float totalCost = hotel.currentPrice * numNights * priceMultiplier * roomsNeeded;
-    //Check budget
-    if (user.maxBudget > 0 && (user.totalSpent + totalCost) > user.maxBudget) 
-        return false;
-    //Calculates checkout date
-    int checkoutDay = bookingDay + numNights;
-    int checkoutMonth = bookingMonth;
-    int checkoutYear = bookingYear;
-    while (checkoutDay > 30) {
-        checkoutDay -= 30;
-        checkoutMonth++;
-        if (checkoutMonth > 12) { checkoutMonth = 1; checkoutYear++; }
-    }
+	float priceMultiplier = getPriceMultiplier(hotelIndex);
+    float roomCost = quoteStay(hotelIndex, daysFromToday(checkIn), numNights);
+    float totalCost = roomCost * priceMultiplier * roomsNeeded;
     Booking booking;
-    booking.hotelName = hotel.name;
-    booking.city = hotel.city;
+    booking.hotelName = getHotelName(hotelIndex);
+    booking.city = CITIES[hotels.cityId[hotelIndex]];
     booking.bookingId = generateBookingId();
-    booking.checkInDate = formatDate(bookingDay, bookingMonth, bookingYear);
-    booking.checkOutDate = formatDate(checkoutDay, checkoutMonth, checkoutYear);
+    booking.checkIn = checkIn;
+    booking.checkOut = checkIn + numNights;
     booking.nights = numNights;
     booking.guests = numGuests;
     booking.rooms = roomsNeeded;
     booking.totalCost = totalCost;
     booking.isActive = true;
+    booking.hotelId = hotelIndex;
+    string record = "BOOK\t" + to_string(booking.bookingId) + "\t" + journalText(booking.hotelName) + "\t" +
+                    journalText(booking.city) + "\t" + to_string(checkIn) + "\t" + to_string(numNights) + "\t" +
+                    to_string(numGuests) + "\t" + to_string(roomsNeeded) + "\t" + to_string(totalCost);
 
-    bookings[bookingCount++] = booking;
-    user.totalBookings++;
-    user.totalSpent += totalCost;
-    user.placesVisited++;
-	updateUserLevel();
-    updateTravelerScore();
-    updateAchievements();
+    //The budget is taken first and given back if the rooms run short
+    if (!addSpent(totalCost, true)) return -1;
+    {
+        lock_guard<mutex> hotelGuard(hotelLock(hotelIndex));
+        if (!reserveRooms(hotelIndex, checkIn, numNights, roomsNeeded)) {
+            addSpent(-totalCost, false);
+            return -1;
+        }
+    }
+    int slot;
+    {
+        //Journaled under the lock, so a cancel is never journaled before its booking
+        lock_guard<mutex> accountGuard(accountMutex);
+        slot = addBookingRecord(booking);
+        hotelActiveBookings[hotelIndex]++;
+        indexStay(slot);
+        appendJournal(record);
+    }
+    scheduleEvent(booking.checkOut, EVENT_CHECKOUT, slot);
+    return slot;
+}
+//Claim a live booking for one edit or cancel and copy it out, false if the
+//handle is stale or another call holds the claim. Its rooms can then be
+//moved under the hotel lock alone.
+bool claimBooking(BookingHandle handle, Booking& copy) {
+    lock_guard<mutex> lock(accountMutex);
+    Booking* b = findBooking(handle);
+    if (b == NULL || bookingSlot(handle.slot).claimed) return false;
+    bookingSlot(handle.slot).claimed = true;
+    copy = *b;
+    return true;
+}
+void releaseClaim(int slot) {
+    lock_guard<mutex> lock(accountMutex);
+    bookingSlot(slot).claimed = false;
+}
+//Move a booking to new dates and guests. Fails if the booking is gone or
+//being changed by another call, the new total is over budget or the rooms
+//are not free; the old stay is kept then.
+bool updateBooking(BookingHandle handle, DayNumber checkIn, int numNights, int numGuests) {
+    shared_lock<DayLock> day(dayLock);
+    if (checkIn < appDate) return false;
+    Booking old;
+    if (!claimBooking(handle, old)) return false;
+    int hotel = old.hotelId;
+    if (hotel == -1) {
+        releaseClaim(handle.slot);
+        return false;
+    }
+    int roomsNeeded = (numGuests + MAX_GUESTS_PER_ROOM - 1) / MAX_GUESTS_PER_ROOM;
+    float newCost = quoteStay(hotel, daysFromToday(checkIn), numNights) * roomsNeeded;
+    string record = "EDIT\t" + to_string(old.bookingId) + "\t" + to_string(checkIn) + "\t" + to_string(numNights) +
+                    "\t" + to_string(numGuests) + "\t" + to_string(roomsNeeded) + "\t" + to_string(newCost);
 
-    //Track in planner
-    if (planner.enabled){
-        planner.spentInPlan += totalCost;
-        planner.tripsInPlan++;
-	}
-    saveGame();
+    //A dearer stay takes the difference up front, a cheaper one gives it
+    //back once the edit is in
+    float extra = newCost - old.totalCost;
+    bool moved = extra <= 0 || addSpent(extra, true);
+    if (moved) {
+        lock_guard<mutex> hotelGuard(hotelLock(hotel));
+        //Free the old nights first so the stay can move onto overlapping dates
+        releaseRooms(hotel, old.checkIn, old.nights, old.rooms);
+        if (!reserveRooms(hotel, checkIn, numNights, roomsNeeded)) {
+            //Put the old stay back, nights before today stay out of the inventory
+            for (int d = 0; d < old.nights; d++) {
+                if (old.checkIn + d >= appDate) changeRoomsBooked(hotel, old.checkIn + d, old.rooms);
+            }
+            if (extra > 0) addSpent(-extra, false);
+            moved = false;
+        }
+    }
+    if (!moved) {
+        releaseClaim(handle.slot);
+        return false;
+    }
+    {
+        lock_guard<mutex> accountGuard(accountMutex);
+        unindexStay(handle.slot);
+        editBookingRecord(bookingAt(handle.slot), checkIn, numNights, numGuests, roomsNeeded, newCost);
+        indexStay(handle.slot);
+        appendJournal(record);
+        bookingSlot(handle.slot).claimed = false;
+    }
+    if (extra < 0) addSpent(extra, false);
+    scheduleEvent(checkIn + numNights, EVENT_CHECKOUT, handle.slot);
     return true;
 }
 
-int SearchHotels(int outResults[], int maxResults,
+string toLowerCopy(const string& text) {
+    string lower = text;
+    for (int i = 0; i < (int)lower.length(); i++) lower[i] = (char)tolower((unsigned char)lower[i]);
+    return lower;
+}
+//City and category text is matched once against the ID tables,
+//the hotel loops only compare IDs
+void matchFacetText(const string& city, const string& category, bool cityMatch[], bool categoryMatch[]) {
+    for (int c = 0; c < MAX_CITIES; c++) cityMatch[c] = containsIgnoreCase(CITIES[c], city);
+    for (int c = 0; c < MAX_CATEGORIES; c++) categoryMatch[c] = containsIgnoreCase(CATEGORIES[c], category);
+}
+//Keep only the hotels in the list that match every filter (name already lowercased)
+void filterHotels(vector<int>& hotelList, const string& lowerName, bool checkName,
+                  const string& city, const string& category, float minPrice, float maxPrice,
+                  unsigned char requiredFlags) {
+    bool cityMatch[MAX_CITIES];
+    bool categoryMatch[MAX_CATEGORIES];
+    matchFacetText(city, category, cityMatch, categoryMatch);
+    const float* multipliers = MODE_MULTIPLIERS[user.budgetMode ? 1 : 0];
+    unsigned char mustHave = requiredFlags | HOTEL_ACTIVE;
+
+    int count = 0;
+    for (int k = 0; k < (int)hotelList.size(); k++) {
+        int i = hotelList[k];
+        if ((hotels.flags[i] & mustHave) != mustHave) continue;
+        if (!cityMatch[hotels.cityId[i]]) continue;
+        int categoryId = hotels.categoryId[i];
+        if (!categoryMatch[categoryId]) continue;
+        float effectivePrice = hotels.currentPrice[i] * multipliers[categoryId];
+        if (effectivePrice < minPrice || effectivePrice > maxPrice) continue;
+        if (checkName && !lowerNameContains(i, lowerName)) continue;
+        hotelList[count++] = i;
+    }
+    hotelList.resize(count);
+}
+
+//requiredFlags: HOTEL_WIFI / HOTEL_POOL / HOTEL_DEAL bits a hotel must have
+int SearchHotels(vector<int>& outResults,
                  string name, string city,
-                 string category, float minPrice, float maxPrice) {
+                 string category, float minPrice, float maxPrice,
+                 unsigned char requiredFlags = 0) {
+    //Facets (active, city, category, amenities) are combined as bitmaps first
+    bool cityMatch[MAX_CITIES];
+    bool categoryMatch[MAX_CATEGORIES];
+    matchFacetText(city, category, cityMatch, categoryMatch);
+    buildFacetFilter(cityMatch, categoryMatch, requiredFlags, queryBitmap);
+
+    outResults.clear();
+    int mode = user.budgetMode ? 1 : 0;
+    int first = 0, last = 0;
+    if (priceIndexBuilt) priceIndexRange(mode, minPrice, maxPrice, first, last);
+    if (!name.empty()) {
+        findHotelsByName(toLowerCopy(name), outResults);
+    } else if (priceIndexBuilt && (last - first) < hotelCount / 4) {
+        //Narrow price range, start from the matching slice of the price index
+        const vector<int>& ids = priceIndex[mode].hotelIds;
+        for (int k = first; k < last; k++) {
+            if (bitmapTest(queryBitmap, ids[k])) outResults.push_back(ids[k]);
+        }
+        sort(outResults.begin(), outResults.end());
+    } else {
+        const vector<unsigned long long>& words = queryBitmap.words;
+        for (int w = 0; w < (int)words.size(); w++) {
+            unsigned long long word = words[w];
+            while (word != 0) {
+                outResults.push_back(w * 64 + lowestBit64(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    //Price check, plus the facet bits for name candidates
+    const float* multipliers = MODE_MULTIPLIERS[mode];
     int count = 0;
+    for (int k = 0; k < (int)outResults.size(); k++) {
+        int i = outResults[k];
+        if (!bitmapTest(queryBitmap, i)) continue;
+        float effectivePrice = hotels.currentPrice[i] * multipliers[hotels.categoryId[i]];
+        if (effectivePrice < minPrice || effectivePrice > maxPrice) continue;
+        outResults[count++] = i;
+    }
+    outResults.resize(count);
+    return count;
+}
 
-    for (int i = 0; i < hotelCount && count < maxResults; i++) {
-        Hotel h = hotels[i];
-        if (!h.isActive) continue;
-
-        bool nameMatch = containsIgnoreCase(h.name, name);
-        bool cityMatch = containsIgnoreCase(h.city, city);
-        bool categoryMatch = containsIgnoreCase(h.category, category);
-        float effectivePrice = h.currentPrice * getPriceMultiplier(h);
-        bool priceMatch = (effectivePrice >= minPrice && effectivePrice <= maxPrice);
-        if (nameMatch && cityMatch && categoryMatch && priceMatch) {
-            outResults[count] = i;
-            count++;
+//True when every hotel matching the new query also matched the step
+bool queryNarrows(const RefineStep& step, const string& lowerName, const string& lowerCity,
+                  const string& lowerCategory, float minPrice, float maxPrice, unsigned char requiredFlags) {
+    return step.epoch == priceEpoch && step.budgetMode == user.budgetMode &&
+           minPrice >= step.minPrice && maxPrice <= step.maxPrice &&
+           (requiredFlags & step.requiredFlags) == step.requiredFlags &&
+           lowerName.find(step.name) != string::npos &&
+           lowerCity.find(step.city) != string::npos &&
+           lowerCategory.find(step.category) != string::npos;
+}
+//Search using the typing history. Adding a character only re-filters the
+//previous results, backspace returns to an earlier step, anything else
+//starts over with a full search.
+void searchIncremental(vector<int>& outResults, const string& name, const string& city,
+                       const string& category, float minPrice, float maxPrice, unsigned char requiredFlags) {
+    string lowerName = toLowerCopy(name);
+    string lowerCity = toLowerCopy(city);
+    string lowerCategory = toLowerCopy(category);
+    int shape = (city.empty() ? 0 : 1) | (category.empty() ? 0 : 2);
+    vector<RefineStep>& refineStack = refineStacks[shape];
+    while (!refineStack.empty() &&
+           !queryNarrows(refineStack.back(), lowerName, lowerCity, lowerCategory, minPrice, maxPrice, requiredFlags)) {
+        refineStack.pop_back();
+    }
+    //Nothing of this shape to refine, e.g. a city was just typed: start from
+    //the smallest step of another shape that this query narrows, without
+    //popping that shape's history
+    const RefineStep* start = refineStack.empty() ? NULL : &refineStack.back();
+    for (int other = 0; other < REFINE_SHAPES && refineStack.empty(); other++) {
+        if (other == shape) continue;
+        const vector<RefineStep>& steps = refineStacks[other];
+        for (int k = (int)steps.size() - 1; k >= 0; k--) {
+            if (!queryNarrows(steps[k], lowerName, lowerCity, lowerCategory, minPrice, maxPrice, requiredFlags)) continue;
+            if (start == NULL || steps[k].results.size() < start->results.size()) start = &steps[k];
+            break;
+        }
+    }
+
+    if (start != NULL) {
+        const RefineStep& top = *start;
+        outResults = top.results;
+        bool sameQuery = top.name == lowerName && top.city == lowerCity && top.category == lowerCategory &&
+                         top.minPrice == minPrice && top.maxPrice == maxPrice && top.requiredFlags == requiredFlags;
+        if (sameQuery) return;
+        filterHotels(outResults, lowerName, !lowerName.empty(), city, category, minPrice, maxPrice, requiredFlags);
+        refinedSearches++;
+    } else {
+        SearchHotels(outResults, name, city, category, minPrice, maxPrice, requiredFlags);
+    }
+
+    if ((int)refineStack.size() >= MAX_REFINE_STEPS) refineStack.erase(refineStack.begin());
+    RefineStep step;
+    step.name = lowerName;
+    step.city = lowerCity;
+    step.category = lowerCategory;
+    step.minPrice = minPrice;
+    step.maxPrice = maxPrice;
+    step.requiredFlags = requiredFlags;
+    step.budgetMode = user.budgetMode;
+    step.epoch = priceEpoch;
+    step.results = outResults;
+    refineStack.push_back(step);
+}
+
+//Memoized SearchHotels. A hit returns the stored result vector without
+//touching the catalog, the least recently used entry is replaced on a miss.
+const SearchCacheEntry& searchCachedEntry(const string& name, const string& city,
+                                          const string& category, float minPrice, float maxPrice,
+                                          unsigned char requiredFlags) {
+    searchCacheClock++;
+    int victim = 0;
+    for (int e = 0; e < SEARCH_CACHE_SIZE; e++) {
+        SearchCacheEntry& entry = searchCache[e];
+        if (entry.valid && entry.epoch == priceEpoch && entry.budgetMode == user.budgetMode &&
+            entry.minPrice == minPrice && entry.maxPrice == maxPrice && entry.requiredFlags == requiredFlags &&
+            entry.name == name && entry.city == city && entry.category == category) {
+            entry.lastUsed = searchCacheClock;
+            searchCacheHits++;
+            return entry;
         }
+        if (!entry.valid) victim = e;
+        else if (searchCache[victim].valid && entry.lastUsed < searchCache[victim].lastUsed) victim = e;
+    }
+
+    searchCacheMisses++;
+    SearchCacheEntry& entry = searchCache[victim];
+    entry.valid = true;
+    entry.name = name;
+    entry.city = city;
+    entry.category = category;
+    entry.minPrice = minPrice;
+    entry.maxPrice = maxPrice;
+    entry.requiredFlags = requiredFlags;
+    entry.budgetMode = user.budgetMode;
+    entry.epoch = priceEpoch;
+    entry.lastUsed = searchCacheClock;
+    entry.generation = ++searchGenerationCounter;
+    searchIncremental(entry.results, name, city, category, minPrice, maxPrice, requiredFlags);
+    return entry;
+}
+const vector<int>& searchHotelsCached(const string& name, const string& city,
+                                      const string& category, float minPrice, float maxPrice,
+                                      unsigned char requiredFlags = 0) {
+    return searchCachedEntry(name, city, category, minPrice, maxPrice, requiredFlags).results;
+}
+
+//Facet counts for a query, recomputed only when the query or epoch changes.
+//Only name, price and amenities go through a search; city and category are
+//then applied as facet bitmaps, so each count is a popcount of that result
+//against the other dimension's filter and one facet bitmap.
+const FacetCounts& getFacetCounts(const string& name, const string& city, const string& category,
+                                  float minPrice, float maxPrice, unsigned char requiredFlags) {
+    FacetCounts& counts = facetCounts;
+    if (counts.valid && counts.epoch == priceEpoch && counts.budgetMode == user.budgetMode &&
+        counts.minPrice == minPrice && counts.maxPrice == maxPrice && counts.requiredFlags == requiredFlags &&
+        counts.name == name && counts.city == city && counts.category == category) {
+        return counts;
     }
+    bool cityMatch[MAX_CITIES], anyCity[MAX_CITIES];
+    bool categoryMatch[MAX_CATEGORIES], anyCategory[MAX_CATEGORIES];
+    matchFacetText(city, category, cityMatch, categoryMatch);
+    matchFacetText("", "", anyCity, anyCategory);
+    HotelBitmap base, inCity, inCategory;
+    bitmapFromList(searchHotelsCached(name, "", "", minPrice, maxPrice, requiredFlags), base);
+    buildFacetFilter(cityMatch, anyCategory, 0, inCity);
+    buildFacetFilter(anyCity, categoryMatch, 0, inCategory);
+    bitmapAnd(inCity, base);
+    bitmapAnd(inCategory, base);
+    for (int c = 0; c < MAX_CITIES; c++) counts.cityCount[c] = bitmapCountAnd(inCategory, facets.city[c]);
+    for (int c = 0; c < MAX_CATEGORIES; c++) counts.categoryCount[c] = bitmapCountAnd(inCity, facets.category[c]);
+    //The full query: both filters
+    bitmapAnd(inCity, inCategory);
+    counts.wifiCount = bitmapCountAnd(inCity, facets.wifi);
+    counts.poolCount = bitmapCountAnd(inCity, facets.pool);
+    counts.dealCount = bitmapCountAnd(inCity, facets.deal);
 
+    counts.valid = true;
+    counts.name = name;
+    counts.city = city;
+    counts.category = category;
+    counts.minPrice = minPrice;
+    counts.maxPrice = maxPrice;
+    counts.requiredFlags = requiredFlags;
+    counts.budgetMode = user.budgetMode;
+    counts.epoch = priceEpoch;
+    return counts;
+}
+//How many results have a room free tonight, recounted only when the result
+//set, the inventory or the day changes
+struct FreeTonightCount {
+    bool valid;
+    unsigned int generation;
+    unsigned int inventoryEpoch;
+    DayNumber date;
+    int count;
+};
+FreeTonightCount freeTonight = {false, 0, 0, 0, 0};
+HotelBitmap freeTonightBitmap;
+int countFreeTonight(const SearchCacheEntry& entry) {
+    if (freeTonight.valid && freeTonight.generation == entry.generation &&
+        freeTonight.inventoryEpoch == inventoryEpoch && freeTonight.date == appDate) {
+        return freeTonight.count;
+    }
+    availableHotels(appDate, 1, 1, freeTonightBitmap);
+    int count = 0;
+    for (int k = 0; k < (int)entry.results.size(); k++) {
+        if (bitmapTest(freeTonightBitmap, entry.results[k])) count++;
+    }
+    freeTonight.valid = true;
+    freeTonight.generation = entry.generation;
+    freeTonight.inventoryEpoch = inventoryEpoch;
+    freeTonight.date = appDate;
+    freeTonight.count = count;
     return count;
 }
 
+//Ranked paging
+//Lower values rank first, ties go to the lower hotel ID
+float rankValue(int hotelIndex, int rankKey) {
+    float deal = (hotels.flags[hotelIndex] & HOTEL_DEAL) ? hotels.dealPercent[hotelIndex] : 0.0f;
+    switch (rankKey) {
+        case RANK_PRICE:  return hotels.currentPrice[hotelIndex] * getPriceMultiplier(hotelIndex);
+        case RANK_RATING: return -hotels.rating[hotelIndex];
+        case RANK_DEAL:   return -deal;
+        case RANK_SCORE:  // rating and deals push a hotel up, price pulls it down
+            return -(hotels.rating[hotelIndex] * 20.0f + deal * 0.5f -
+                     hotels.currentPrice[hotelIndex] * getPriceMultiplier(hotelIndex) / 1000.0f);
+        default:          return 0;
+    }
+}
+bool rankBefore(float valueA, int hotelA, float valueB, int hotelB) {
+    return valueA < valueB || (valueA == valueB && hotelA < hotelB);
+}
+//The first pageSize matches after the cursor in rank order. Keeps a bounded
+//max-heap of the best pageSize candidates, so the match list is scanned
+//once and never copied or sorted. Returns how many hotels were written.
+int rankedSearchPage(const vector<int>& matches, int rankKey, int pageSize, const SearchCursor& after,
+                     int outIds[], SearchCursor outCursors[]) {
+    if (pageSize > MAX_PAGE_SIZE) pageSize = MAX_PAGE_SIZE;
+    int count = 0;
+    if (rankKey == RANK_CATALOG) {
+        //Matches are already in catalog order, jump straight to the cursor
+        vector<int>::const_iterator it = matches.begin();
+        if (after.started) it = upper_bound(matches.begin(), matches.end(), after.hotelIndex);
+        for (; it != matches.end() && count < pageSize; ++it) {
+            outIds[count] = *it;
+            outCursors[count].started = true;
+            outCursors[count].rankValue = 0;
+            outCursors[count].hotelIndex = *it;
+            count++;
+        }
+        return count;
+    }
 
-bool cancelBooking(int index) {
-    if (index < 0 || index >= bookingCount) return false;
-    if (!bookings[index].isActive) return false;
-    
-    user.totalSpent -= bookings[index].totalCost;
+    vector<pair<float, int>> heap;  // max-heap, top = worst of the best so far
+    heap.reserve(pageSize + 1);
+    for (int k = 0; k < (int)matches.size(); k++) {
+        int h = matches[k];
+        float value = rankValue(h, rankKey);
+        if (after.started && !rankBefore(after.rankValue, after.hotelIndex, value, h)) continue;
+        if ((int)heap.size() < pageSize) {
+            heap.push_back(make_pair(value, h));
+            push_heap(heap.begin(), heap.end());
+        } else if (rankBefore(value, h, heap.front().first, heap.front().second)) {
+            pop_heap(heap.begin(), heap.end());
+            heap.back() = make_pair(value, h);
+            push_heap(heap.begin(), heap.end());
+        }
+    }
+    sort_heap(heap.begin(), heap.end());
+    for (int k = 0; k < (int)heap.size(); k++) {
+        outIds[count] = heap[k].second;
+        outCursors[count].started = true;
+        outCursors[count].rankValue = heap[k].first;
+        outCursors[count].hotelIndex = heap[k].second;
+        count++;
+    }
+    return count;
+}
+//Visible page for the current scroll cursor, recomputed only when the
+//results, prices, order or cursor change
+const SearchPage& getResultPage(const SearchCacheEntry& results, int rankKey, int pageSize) {
+    SearchPage& page = resultPage;
+    bool sameStart = page.start.started == pageStart.started && page.start.rankValue == pageStart.rankValue &&
+                     page.start.hotelIndex == pageStart.hotelIndex;
+    if (page.valid && page.generation == results.generation && page.epoch == priceEpoch &&
+        page.rankKey == rankKey && page.pageSize == pageSize && sameStart) {
+        return page;
+    }
+    page.valid = true;
+    page.generation = results.generation;
+    page.epoch = priceEpoch;
+    page.rankKey = rankKey;
+    page.pageSize = pageSize;
+    page.start = pageStart;
+    page.count = rankedSearchPage(results.results, rankKey, pageSize, pageStart, page.hotelIds, page.cursors);
+    return page;
+}
+void resetResultScroll() {
+    scrollPosition = 0;
+    pageStart.started = false;
+    pageHistory.clear();
+}
+void scrollResultsDown(const SearchPage& page) {
+    if (page.count == 0) return;
+    pageHistory.push_back(pageStart);
+    pageStart = page.cursors[0];
+    scrollPosition++;
+}
+void scrollResultsUp() {
+    if (pageHistory.empty()) return;
+    pageStart = pageHistory.back();
+    pageHistory.pop_back();
+    scrollPosition--;
+}
+//Draw scroll buttons for result lists
+void drawScrollButtons(const SearchPage& page, int totalItems, int visibleItems, int y) {
+    if (scrollPosition > 0 && drawButton(450, y, 70, 35, "Up", GRAY)) {
+        scrollResultsUp();
+    }
+    if (scrollPosition + visibleItems < totalItems && drawButton(530, y, 70, 35, "Down", GRAY)) {
+        scrollResultsDown(page);
+    }
+}
+
+//Drop a cancelled booking, shared by cancelBooking and replay. The caller
+//gives the spending back.
+void cancelBookingRecord(int slot) {
+    const Booking& b = bookingAt(slot);
     user.totalBookings--;
     user.placesVisited--;
-    bookings[index].isActive = false;
+    hashErase(bookingIdIndex, bookingIdHash(b.bookingId), slot);
+    freeBookingSlot(slot);
 	updateUserLevel();
     updateTravelerScore();
-    saveGame();
-
+}
+bool cancelBooking(BookingHandle handle) {
+    shared_lock<DayLock> day(dayLock);
+    Booking b;
+    //Fails if another caller cancelled it or is changing it
+    if (!claimBooking(handle, b)) return false;
+    string record = "CANCEL\t" + to_string(b.bookingId);
+    if (b.hotelId != -1) {
+        lock_guard<mutex> hotelGuard(hotelLock(b.hotelId));
+        releaseBookingRooms(b);
+    }
+    //Nothing can fail from here, so the refund may go before the record
+    addSpent(-b.totalCost, false);
+    lock_guard<mutex> accountGuard(accountMutex);
+    unindexStay(handle.slot);
+    if (b.hotelId != -1) hotelActiveBookings[b.hotelId]--;
+    appendJournal(record);
+    cancelBookingRecord(handle.slot);
     return true;
 }
-bool loadGame() {
-    ifstream file("musafir_save.txt");
-    if (!file.is_open()) return false;
-    
+//Move a finished trip to the history, shared by completeTrip and replay
+void completeTripRecord(int slot) {
+    Booking& b = bookingAt(slot);
+    markHotelVisited(b.hotelName, b.city);
+    destinationsTravelled++;
+    if (user.placesVisited > 0) {
+        user.placesVisited--;
+    }
+    hashErase(bookingIdIndex, bookingIdHash(b.bookingId), slot);
+    bookingHistory.push_back(b);
+    bookingHistory.back().isActive = false;
+    freeBookingSlot(slot);
+}
+//Checkout event for a booking, ignored if the booking was cancelled or moved since
+bool completeTrip(int bookingIndex, DayNumber day) {
+    if (!isLiveBooking(bookingIndex)) return false;
+    Booking& b = bookingAt(bookingIndex);
+    if (b.checkOut != day) return false;
+    unindexStay(bookingIndex);
+    if (b.hotelId != -1) hotelActiveBookings[b.hotelId]--;
+    appendJournal("TRIP\t" + to_string(b.bookingId));
+    completeTripRecord(bookingIndex);
+    return true;
+}
+void runDueEvents() {
+    lock_guard<DayLock> day(dayLock);
+    vector<ScheduledEvent> events;
+    {
+        lock_guard<mutex> lock(scheduleMutex);
+        events.swap(dueEvents);
+    }
+    vector<int> changedCities;
+    vector<int> changedHotels;
+    bool tripsCompleted = false;
+    for (int k = 0; k < (int)events.size(); k++) {
+        const ScheduledEvent& e = events[k];
+        if (e.type == EVENT_WEATHER) {
+            if (applyForecastWeather(e.target)) changedCities.push_back(e.target);
+        } else if (e.type == EVENT_DEAL_END) {
+            if (endHotelDeal(e.target, e.day)) changedHotels.push_back(e.target);
+        } else if (e.type == EVENT_CHECKOUT) {
+            lock_guard<mutex> lock(accountMutex);
+            if (completeTrip(e.target, e.day)) tripsCompleted = true;
+        }
+    }
+    repriceHotels(changedCities, changedHotels);
+    //One commit for all the trips that ended today
+    if (tripsCompleted) {
+        updateAchievements();
+        requestJournalCommit();
+    }
+}
+//Older text snapshot, one field per line
+bool readProfile(istream& file) {
     getline(file, user.name);
     file >> user.totalBookings;
-    file >> user.totalSpent;
+    float totalSpent;
+    file >> totalSpent;
+    user.totalSpent = totalSpent;
     file >> user.placesVisited;
     file >> user.maxBudget;
     int budgetMode;
@@ -911,43 +3888,282 @@ bool loadGame() {
         getline(file, visitedHotelNames[i]);
         getline(file, visitedHotelCities[i]);
     }
+    buildVisitedIndex();
       int loadedCount;
     file >> loadedCount;
     file.ignore();
     
-    for (int i = 0; i < MAX_BOOKINGS; i++) {
-        bookings[i].isActive = false;
-    }
-
-    if (loadedCount < 0) loadedCount = 0;
-    if (loadedCount > MAX_BOOKINGS) loadedCount = MAX_BOOKINGS;
-
-    bookingCount = 0;
-    for (int i = 0; i < loadedCount; i++) {
+    clearBookings();
+    for (int i = 0; i < loadedCount && file; i++) {
         Booking b;
         getline(file, b.hotelName);
         getline(file, b.city);
-        getline(file, b.bookingId);
-        getline(file, b.checkInDate);
-        getline(file, b.checkOutDate);
+        string bookingId, checkInDate, checkOutDate;
+        getline(file, bookingId);
+        getline(file, checkInDate);
+        getline(file, checkOutDate);
         file >> b.nights;
         file >> b.guests;
         file >> b.rooms;
         file >> b.totalCost;
         file.ignore();
         b.isActive = true;
+        b.bookingId = strtoull(bookingId.c_str(), NULL, 10);  // older saves have 4-digit IDs
+        noteBookingId(b.bookingId);
+        b.hotelId = -1;  // resolved once the catalog is loaded
+        b.checkIn = parseDate(checkInDate);
+        b.checkOut = b.checkIn + b.nights;
 		
-	  if (bookingCount < MAX_BOOKINGS) {
-            bookings[bookingCount] = b;
-            bookingCount++;
+        bookingAt(allocBookingSlot()) = b;
+    }
+    BookingId savedLastId;
+    if (file >> savedLastId) noteBookingId(savedLastId);
+    return !user.name.empty();
+}
+//Read a binary snapshot written by encodeSave. Nothing is changed unless
+//the checksums match and every offset and index is in range.
+//Checksums, version and column bounds of a snapshot, plus its string offsets
+bool readSaveHeader(const unsigned char* data, size_t size, SaveFileHeader& header,
+                    vector<unsigned int>& stringOffsets) {
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    unsigned int headerChecksum = header.headerChecksum;
+    header.headerChecksum = 0;
+    if (header.magic != SAVE_MAGIC || header.version != SAVE_VERSION || header.headerBytes != sizeof(header) ||
+        header.fileSize != size || hashBytes((const char*)&header, sizeof(header)) != headerChecksum ||
+        hashBytes((const char*)data + sizeof(header), size - sizeof(header)) != header.dataChecksum) {
+        return false;
+    }
+    size_t n = header.stringCount;
+    if (!catalogColumnFits(header.bookingOffset, (size_t)header.bookingCount * sizeof(SavedBooking), size, 1) ||
+        !catalogColumnFits(header.noteOffset, (size_t)header.noteCount * sizeof(unsigned int), size, 1) ||
+        !catalogColumnFits(header.visitedOffset, (size_t)header.visitedCount * 2 * sizeof(unsigned int), size, 1) ||
+        !catalogColumnFits(header.stringOffsetOffset, (n + 1) * sizeof(unsigned int), size, 1) ||
+        !catalogColumnFits(header.stringDataOffset, header.stringBytes, size, 1)) {
+        return false;
+    }
+    stringOffsets.resize(n + 1);
+    memcpy(stringOffsets.data(), data + header.stringOffsetOffset, (n + 1) * sizeof(unsigned int));
+    if (stringOffsets[0] != 0 || stringOffsets[n] != header.stringBytes) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (stringOffsets[i] > stringOffsets[i + 1]) return false;
+    }
+    return header.nameString < n;
+}
+bool decodeSave(const unsigned char* data, size_t size, unsigned long long& journalSeq) {
+    SaveFileHeader header;
+    vector<unsigned int> stringOffsets;
+    if (!readSaveHeader(data, size, header, stringOffsets)) return false;
+    size_t n = header.stringCount;
+    vector<unsigned int> notes(header.noteCount), visited(header.visitedCount * 2);
+    if (!notes.empty()) memcpy(notes.data(), data + header.noteOffset, notes.size() * sizeof(unsigned int));
+    if (!visited.empty()) memcpy(visited.data(), data + header.visitedOffset, visited.size() * sizeof(unsigned int));
+    vector<SavedBooking> bookings(header.bookingCount);
+    if (!bookings.empty()) memcpy(bookings.data(), data + header.bookingOffset, bookings.size() * sizeof(SavedBooking));
+    bool ok = true;
+    for (size_t i = 0; ok && i < notes.size(); i++) ok = notes[i] < n;
+    for (size_t i = 0; ok && i < visited.size(); i++) ok = visited[i] < n;
+    for (size_t i = 0; ok && i < bookings.size(); i++) {
+        ok = bookings[i].hotelName < n && bookings[i].city < n && bookings[i].nights > 0;
+    }
+    if (!ok) return false;
+
+    //The strings, each built once
+    const char* stringData = (const char*)data + header.stringDataOffset;
+    vector<string> strings(n);
+    for (size_t i = 0; i < n; i++) {
+        strings[i].assign(stringData + stringOffsets[i], stringOffsets[i + 1] - stringOffsets[i]);
+    }
+    user.name = strings[header.nameString];
+    user.totalBookings = header.totalBookings;
+    user.totalSpent = header.totalSpent;
+    user.placesVisited = header.placesVisited;
+    user.maxBudget = header.maxBudget;
+    user.budgetMode = (header.flags & SAVE_BUDGET_MODE) != 0;
+    user.level = header.level;
+    planner.enabled = (header.flags & SAVE_PLANNER) != 0;
+    planner.totalBudget = header.plannerBudget;
+    planner.plannedTrips = header.plannedTrips;
+    planner.spentInPlan = header.spentInPlan;
+    planner.tripsInPlan = header.tripsInPlan;
+    noteCount = min((int)notes.size(), MAX_NOTES);
+    for (int i = 0; i < MAX_NOTES; i++) plannerNotes[i] = i < noteCount ? strings[notes[i]] : "";
+    badges.frequentTraveler = (header.flags & SAVE_FREQUENT_TRAVELER) != 0;
+    badges.budgetMaster = (header.flags & SAVE_BUDGET_MASTER) != 0;
+    badges.explorer = (header.flags & SAVE_EXPLORER) != 0;
+    destinationsTravelled = header.destinationsTravelled;
+    visitedHotelCount = min((int)header.visitedCount, MAX_VISITED_HOTELS);
+    for (int i = 0; i < visitedHotelCount; i++) {
+        visitedHotelNames[i] = strings[visited[2 * i]];
+        visitedHotelCities[i] = strings[visited[2 * i + 1]];
+    }
+    buildVisitedIndex();
+
+    clearBookings();
+    for (size_t i = 0; i < bookings.size(); i++) {
+        const SavedBooking& saved = bookings[i];
+        Booking& b = bookingAt(allocBookingSlot());
+        b.hotelName = strings[saved.hotelName];
+        b.city = strings[saved.city];
+        b.bookingId = saved.bookingId;
+        b.checkIn = saved.checkIn;
+        b.nights = saved.nights;
+        b.checkOut = b.checkIn + b.nights;
+        b.guests = saved.guests;
+        b.rooms = saved.rooms;
+        b.totalCost = saved.totalCost;
+        b.isActive = true;
+        b.hotelId = -1;  // resolved once the catalog is loaded
+        noteBookingId(b.bookingId);
+    }
+    noteBookingId(header.lastBookingId);
+    journalSeq = header.journalSeq;
+    return !user.name.empty();
+}
+//Read a snapshot from a file, binary or older text
+bool readSaveFile(const char* binaryPath, const char* textPath, unsigned long long& journalSeq, bool& wasText) {
+    MappedFile file;
+    wasText = false;
+    if (mapFile(binaryPath, file)) {
+        bool ok = decodeSave(file.data, file.size, journalSeq);
+        unmapFile(file);
+        if (ok) return true;
+    }
+    wasText = true;
+    ifstream text(textPath);
+    if (!text.is_open()) return false;
+    if (!readProfile(text)) return false;
+    if (!(text >> journalSeq)) journalSeq = 0;
+    return true;
+}
+string userKeyFor(const string& name) {
+    return toLowerCopy(name);
+}
+//Traveler name stored in a save file, without loading the rest
+bool readSavedName(const string& binaryPath, const string& textPath, string& name) {
+    MappedFile file;
+    if (mapFile(binaryPath.c_str(), file)) {
+        SaveFileHeader header;
+        vector<unsigned int> stringOffsets;
+        bool ok = readSaveHeader(file.data, file.size, header, stringOffsets);
+        if (ok) {
+            const char* text = (const char*)file.data + header.stringDataOffset + stringOffsets[header.nameString];
+            name.assign(text, stringOffsets[header.nameString + 1] - stringOffsets[header.nameString]);
         }
+        unmapFile(file);
+        if (ok) return true;
     }
-    
-    file.close();
+    ifstream text(textPath.c_str());
+    return text.is_open() && getline(text, name);
+}
+bool legacyProfileIsFor(const string& userKey) {
+    string name;
+    return readSavedName(legacyProfilePath(userKey), legacyProfilePath(userKey, ".txt"), name) &&
+           userKeyFor(name) == userKey;
+}
+//Apply one journal record (fields split on tabs), false if it is malformed
+bool replayJournalRecord(const vector<string>& fields) {
+    const string& type = fields[1];
+    if (type == "BOOK" && fields.size() == 10) {
+        Booking b;
+        b.bookingId = strtoull(fields[2].c_str(), NULL, 10);
+        b.hotelName = fields[3];
+        b.city = fields[4];
+        b.checkIn = atoi(fields[5].c_str());
+        b.nights = atoi(fields[6].c_str());
+        b.guests = atoi(fields[7].c_str());
+        b.rooms = atoi(fields[8].c_str());
+        b.totalCost = (float)atof(fields[9].c_str());
+        b.checkOut = b.checkIn + b.nights;
+        b.isActive = true;
+        b.hotelId = -1;  // resolved once the catalog is loaded
+        noteBookingId(b.bookingId);
+        addSpent(b.totalCost, false);
+        addBookingRecord(b);
+        return true;
+    }
+    if ((type == "EDIT" && fields.size() == 8) || ((type == "CANCEL" || type == "TRIP") && fields.size() == 3)) {
+        int slot = findBookingById(strtoull(fields[2].c_str(), NULL, 10));
+        if (slot == -1) return false;
+        if (type == "EDIT") {
+            float cost = (float)atof(fields[7].c_str());
+            addSpent(cost - bookingAt(slot).totalCost, false);
+            editBookingRecord(bookingAt(slot), atoi(fields[3].c_str()), atoi(fields[4].c_str()), atoi(fields[5].c_str()),
+                              atoi(fields[6].c_str()), cost);
+        } else if (type == "CANCEL") {
+            addSpent(-bookingAt(slot).totalCost, false);
+            cancelBookingRecord(slot);
+        } else {
+            completeTripRecord(slot);
+            updateAchievements();
+        }
+        return true;
+    }
+    if (type == "SETTINGS" && fields.size() == 9) {
+        user.maxBudget = (float)atof(fields[2].c_str());
+        user.budgetMode = fields[3] == "1";
+        planner.enabled = fields[4] == "1";
+        planner.totalBudget = (float)atof(fields[5].c_str());
+        planner.plannedTrips = atoi(fields[6].c_str());
+        planner.spentInPlan = (float)atof(fields[7].c_str());
+        planner.tripsInPlan = atoi(fields[8].c_str());
+        return true;
+    }
+    if (type == "NOTES" && fields.size() >= 3) {
+        int count = atoi(fields[2].c_str());
+        if (count < 0 || count > MAX_NOTES || (int)fields.size() != 3 + count) return false;
+        for (int i = 0; i < MAX_NOTES; i++) plannerNotes[i] = i < count ? fields[3 + i] : "";
+        noteCount = count;
+        return true;
+    }
+    return false;
+}
+//Apply the journal records newer than the snapshot. Replay stops at a torn
+//or malformed record, nothing after it was ever committed as a whole.
+void replayJournal(unsigned long long snapshotSeq) {
+    hashClear(bookingIdIndex);
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        int slot = bookingStore.live[k];
+        hashInsert(bookingIdIndex, bookingIdHash(bookingAt(slot).bookingId), slot);
+    }
+    ifstream file(JOURNAL_FILE);
+    string line;
+    while (getline(file, line) && !file.eof()) {
+        vector<string> fields;
+        size_t start = 0;
+        while (true) {
+            size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab == string::npos ? string::npos : tab - start));
+            if (tab == string::npos) break;
+            start = tab + 1;
+        }
+        if (fields.size() < 2) break;
+        unsigned long long seq = strtoull(fields[0].c_str(), NULL, 10);
+        if (seq <= snapshotSeq) continue;
+        if (!replayJournalRecord(fields)) break;
+        journal.lastSeq = seq;
+        journal.durableSeq = seq;
+        journal.records++;
+    }
+}
+bool loadGame() {
+    unsigned long long snapshotSeq;
+    bool wasText;
+    if (!readSaveFile(SAVE_FILE, TEXT_SAVE_FILE, snapshotSeq, wasText)) return false;
+    journal.pending.clear();
+    journal.lastSeq = snapshotSeq;
+    journal.durableSeq = snapshotSeq;
+    journal.records = 0;
+    replayJournal(snapshotSeq);
+    buildStayIndex();
+    currentUserKey = userKeyFor(user.name);
     return !user.name.empty();
 }
 
-void initializeApp() {
+//Fresh state for the traveler being served
+void resetTraveler() {
+    journal.lastSettings = "";
+    journal.lastNotes = "";
     user.name = "";
     user.totalBookings = 0;
     user.totalSpent = 0;
@@ -957,7 +4173,7 @@ void initializeApp() {
     user.maxBudget = 50000;
     user.budgetMode = true;
     user.preferredCityCount = 0;
-    for (int i = 0; i < MAX_PREFERRED_CITIES; i++) user.preferredCities[i] = "";
+    for (int i = 0; i < MAX_PREFERRED_CITIES; i++) user.preferredCities[i] = -1;
     //Initialize planner
     planner.enabled = false;
     planner.totalBudget = 80000;
@@ -983,12 +4199,129 @@ void initializeApp() {
         visitedHotelNames[i] = "";
         visitedHotelCities[i] = "";
     }
+    hashClear(visitedIndex);
+    clearBookings();
+    //Nothing may point at the bookings just dropped
+    stayIndex.byCheckIn.clear();
+    stayIndex.lengths.clear();
+    hashClear(bookingIdIndex);
+    hotelActiveBookings.assign(hotelCount, 0);
+    lastPrefCities = -1;
+}
+
+ProfileShard& profileShard(const string& userKey) {
+    return profileShards[hashString(userKey) % PROFILE_SHARDS];
+}
+//Park the traveler being served in the user table and start a blank one.
+//Their profile file is only rewritten if something changed.
+void parkTraveler() {
+    if (!user.name.empty()) {
+        string state;
+        {
+            lock_guard<mutex> lock(accountMutex);
+            state = encodeSave(0);
+        }
+        bool changed;
+        {
+            ProfileShard& shard = profileShard(currentUserKey);
+            lock_guard<mutex> lock(shard.lock);
+            ProfileEntry& entry = shard.profiles[currentUserKey];
+            changed = entry.state != state;
+            if (changed) entry.state = state;
+            entry.roomsHeld = true;
+        }
+        if (changed) queueProfileWrite(currentUserKey, state);
+    }
+    resetTraveler();
+}
+//Serve a parked traveler, loading their profile file the first time. Call
+//after parkTraveler. Returns false if there is no such profile, leaving the
+//current state alone, or a blank traveler if the profile is unreadable.
+bool serveTraveler(const string& userKey) {
+    currentUserKey = userKey;
+    string state;
+    bool roomsHeld = false;
+    {
+        ProfileShard& shard = profileShard(userKey);
+        lock_guard<mutex> lock(shard.lock);
+        auto it = shard.profiles.find(userKey);
+        if (it != shard.profiles.end()) {
+            state = it->second.state;
+            roomsHeld = it->second.roomsHeld;
+        }
+    }
+    unsigned long long journalSeq;
+    if (state.empty()) {
+        bool wasText;
+        string binaryPath = profilePath(userKey);
+        string textPath = profilePath(userKey, ".txt");
+        bool legacy = !fileExists(binaryPath) && !fileExists(textPath) && legacyProfileIsFor(userKey);
+        if (legacy) {
+            binaryPath = legacyProfilePath(userKey);
+            textPath = legacyProfilePath(userKey, ".txt");
+        }
+        //No file: a new traveler, who keeps what they picked on the login screen
+        if (!fileExists(binaryPath) && !fileExists(textPath)) return false;
+        if (!readSaveFile(binaryPath.c_str(), textPath.c_str(), journalSeq, wasText)) {
+            //Unreadable, and maybe half loaded
+            resetTraveler();
+            updateHotelPrices();
+            return false;
+        }
+        ProfileShard& shard = profileShard(userKey);
+        lock_guard<mutex> lock(shard.lock);
+        ProfileEntry& entry = shard.profiles[userKey];
+        //Text and hash-named profiles are left empty here so parking rewrites
+        //them as binary under the traveler's own file name
+        entry.state = (wasText || legacy) ? "" : encodeSave(0);
+        entry.roomsHeld = false;
+    } else if (!decodeSave((const unsigned char*)state.data(), state.size(), journalSeq)) {
+        resetTraveler();
+        updateHotelPrices();
+        return false;
+    }
+    buildStayIndex();
+    buildBookingIndexes();
+    for (int k = 0; k < (int)bookingStore.live.size(); k++) {
+        int slot = bookingStore.live[k];
+        const Booking& b = bookingAt(slot);
+        //Stays read from disk this session take their rooms now
+        if (!roomsHeld && b.hotelId != -1) {
+            lock_guard<mutex> lock(hotelLock(b.hotelId));
+            for (int d = 0; d < b.nights; d++) {
+                if (b.checkIn + d >= appDate) changeRoomsBooked(b.hotelId, b.checkIn + d, b.rooms);
+            }
+        }
+        //Trips that ended while they were parked complete on the next frame
+        scheduleEvent(b.checkOut, EVENT_CHECKOUT, slot);
+    }
+    return true;
+}
+//Drop a traveler from the table and from disk
+void forgetTraveler(const string& userKey) {
+    {
+        lock_guard<mutex> lock(persistence.lock);
+        persistence.profileWrites.erase(userKey);
+    }
+    flushPersistence();  // a write already under way lands before the remove
+    ProfileShard& shard = profileShard(userKey);
+    lock_guard<mutex> lock(shard.lock);
+    shard.profiles.erase(userKey);
+    remove(profilePath(userKey).c_str());
+    remove(profilePath(userKey, ".txt").c_str());
+    if (legacyProfileIsFor(userKey)) {
+        remove(legacyProfilePath(userKey).c_str());
+        remove(legacyProfilePath(userKey, ".txt").c_str());
+    }
+}
+
+void initializeApp() {
+    resetTraveler();
     
     initializeWeather();
+    //Also builds the booking indexes, room inventory and schedule; the
+    //stay index was emptied with the bookings
     initializeHotels();
-
-    bookingCount = 0;
-    for (int i = 0; i < MAX_BOOKINGS; i++) bookings[i].isActive = false;
 }
 //Functions for screen
 void drawSplashScreen() {
@@ -1012,6 +4345,7 @@ void drawSplashScreen() {
     
     if (splashTimer >= 3.5f) {
         if (loadGame()) {
+            initializeWeather();
             initializeHotels();
             currentScreen = SCREEN_HOME;
         } else {
@@ -1066,7 +4400,8 @@ void drawLoginScreen(){
     //Submit button
     if (drawButton(380, 570, 260, 55, "Start Journey", PAK_GREEN)) {
         if (!inputText.empty()) {
-            user.name = inputText;
+            //A traveler who has been here before picks up where they left off
+            if (!serveTraveler(userKeyFor(inputText))) user.name = inputText;
             saveGame();
             currentScreen = SCREEN_HOME;
         }
@@ -1077,7 +4412,7 @@ void drawHomeScreen() {
     // Header
     DrawRectangle(0, 0, 1024, 80, BG_WHITE);
     // Today's date with simulation button
-    string dateStr = "Today: " + formatDate(appDay, appMonth, appYear);
+    string dateStr = "Today: " + formatDate(appDate);
     drawText(dateStr, 40, 15, 14, GRAY);
     
     // Plus button to simulate day passing
@@ -1152,7 +4487,7 @@ void drawHomeScreen() {
     
     // Navigation buttons
     if (drawButton(40, 180, 200, 50, "Explore", Color{59, 130, 246, 255})) {
-        scrollPosition = 0;
+        resetResultScroll();
         currentScreen = SCREEN_EXPLORE;
     }
     if (drawButton(260, 180, 200, 50, "My Bookings", Color{34, 197, 94, 255})) {
@@ -1160,7 +4495,7 @@ void drawHomeScreen() {
         currentScreen = SCREEN_BOOKINGS;
     }
     if (drawButton(480, 180, 200, 50, "Search", Color{168, 85, 247, 255})) {
-        scrollPosition = 0;
+        resetResultScroll();
         currentScreen = SCREEN_SEARCH;
     }
     if (drawButton(700, 180, 140, 50, "Planner", Color{59, 130, 246, 255})) {
@@ -1175,7 +4510,7 @@ void drawHomeScreen() {
         if (w.type != 0) {
             Color alertColor = (w.type == 1) ? Color{59, 130, 246, 255} : Color{234, 179, 8, 255};
             string alertType = (w.type == 1) ? "Rain" : "Festival";
-            string alert = w.city + ": " + alertType;
+            string alert = CITIES[w.cityId] + ": " + alertType;
             
             drawRoundedBox(alertX, 247, 120, 24, alertColor);
             drawText(alert, alertX + 8, 252, 12, BG_WHITE);
@@ -1197,28 +4532,29 @@ void drawHomeScreen() {
         savedHotels[0] = savedHotels[1] = savedHotels[2] = -1;
 
         if (user.preferredCityCount == 1) {
+            int cityId = user.preferredCities[0];
             for (int i = 0; i < hotelCount && savedHotelCount < 3; i++) {
-                if (hotels[i].isActive && hotels[i].city == user.preferredCities[0]) {
+                if ((hotels.flags[i] & HOTEL_ACTIVE) && hotels.cityId[i] == cityId) {
                     savedHotels[savedHotelCount++] = i;
                 }
             }
         } else {
-            string cities[3];
+            int cities[3];
             int cityCount = 0;
             if (user.preferredCityCount > 1) {
                 for (int i = 0; i < user.preferredCityCount && cityCount < 3; i++)
                     cities[cityCount++] = user.preferredCities[i];
             } else {
-                cities[0] = CITIES[0]; cities[1] = CITIES[1]; cities[2] = CITIES[2];
+                cities[0] = 0; cities[1] = 1; cities[2] = 2;
                 cityCount = 3;
             }
             for (int c = 0; c < cityCount; c++) {
                 int best = -1;
                 for (int i = 0; i < hotelCount; i++) {
-                    if (!hotels[i].isActive || hotels[i].city != cities[c]) continue;
+                    if (!(hotels.flags[i] & HOTEL_ACTIVE) || hotels.cityId[i] != cities[c]) continue;
                     if (best == -1) best = i;
-                    else if (user.budgetMode && hotels[i].currentPrice < hotels[best].currentPrice) best = i;
-                    else if (!user.budgetMode && hotels[i].currentPrice > hotels[best].currentPrice) best = i;
+                    else if (user.budgetMode && hotels.currentPrice[i] < hotels.currentPrice[best]) best = i;
+                    else if (!user.budgetMode && hotels.currentPrice[i] > hotels.currentPrice[best]) best = i;
                 }
                 if (best != -1) savedHotels[savedHotelCount++] = best;
             }
@@ -1244,22 +4580,26 @@ void drawHomeScreen() {
 }
 void drawExploreScreen() {
     drawScreenHeader("Explore Pakistan", SCREEN_HOME);
-    drawCityFilterRow(searchCity, 70);
+    const FacetCounts& counts = getFacetCounts("", searchCity, "", 0, 999999, 0);
+    string previousCity = searchCity;
+    drawCityFilterRow(searchCity, 70, counts.cityCount);
+    if (searchCity != previousCity) resetResultScroll();
     // Get filtered hotels
-    int results[MAX_HOTELS];
-    int resultCount = SearchHotels(results, MAX_HOTELS, "", searchCity, "", 0, 999999);
+    const SearchCacheEntry& results = searchCachedEntry("", searchCity, "", 0, 999999, 0);
+    int resultCount = (int)results.results.size();
+    if (scrollPosition >= resultCount) resetResultScroll();
     
     //Display hotels using helper function
     int y = 115;
     int maxVisible = 6;
+    const SearchPage& page = getResultPage(results, RANK_CATALOG, maxVisible);
     
-    for (int idx = scrollPosition; idx < resultCount && idx < scrollPosition + maxVisible; idx++) {
-        int i = results[idx];
-        drawHotelCard(i, 40, y, 940, 85, true);
+    for (int idx = 0; idx < page.count; idx++) {
+        drawHotelCard(page.hotelIds[idx], 40, y, 940, 85, true);
         y += 95;
     }
     //Scroll buttons using helper
-    drawScrollButtons(scrollPosition, resultCount, maxVisible, 720);
+    drawScrollButtons(page, resultCount, maxVisible, 720);
     
     // Count display
     int showing = resultCount - scrollPosition;
@@ -1271,14 +4611,17 @@ void drawDetailScreen(){
     // Safety check: if no hotel selected, kick back to home
     if (selectedHotelIndex < 0 || selectedHotelIndex >= hotelCount) {
         currentScreen = SCREEN_HOME; return; }
-    Hotel& hotel = hotels[selectedHotelIndex];
+    int h = selectedHotelIndex;
+    int cityId = hotels.cityId[h];
+    int categoryId = hotels.categoryId[h];
+    float currentPrice = hotels.currentPrice[h];
     ClearBackground(BG_LIGHT);
     //Large colorful header based on city color
-    DrawRectangle(0, 0, 1024, 160, getCityColor(hotel.city));
+    DrawRectangle(0, 0, 1024, 160, getCityColor(cityId));
     if (drawButton(15, 15, 40, 40, "<", Color{50, 50, 50, 255})) 
         currentScreen = SCREEN_EXPLORE;
 	//weather indicator
-	int weatherIndex = getWeatherIndexForCity(hotel.city);
+	int weatherIndex = getWeatherIndexForCity(cityId);
     if (weatherIndex != -1 && weatherData[weatherIndex].type != 0) {
         int wType = weatherData[weatherIndex].type;
         string weatherText = (wType == 1) ? "Rainy Weather" : "Festival Season";
@@ -1287,38 +4630,39 @@ void drawDetailScreen(){
     }
     //Main Detail Card
     drawRoundedBox(30, 140, 964, 380, BG_WHITE);
-    drawText(hotel.name, 60, 165, 26, BLACK);
-    drawText(hotel.city + ", Pakistan", 60, 200, 16, GRAY);
-    drawText("Rating: " + to_string(hotel.rating).substr(0, 3), 800, 170, 18, Color{234, 179, 8, 255});
+    drawText(getHotelName(h), 60, 165, 26, BLACK);
+    drawText(CITIES[cityId] + ", Pakistan", 60, 200, 16, GRAY);
+    drawText("Rating: " + to_string(hotels.rating[h]).substr(0, 3), 800, 170, 18, Color{234, 179, 8, 255});
     
     //Tags (Category & Deals)
-    drawRoundedBox(60, 235, 100, 30, getCategoryColor(hotel.category));
-    drawText(hotel.category, 80, 242, 14, BG_WHITE);
-    if (hotel.hasDeal){
+    drawRoundedBox(60, 235, 100, 30, getCategoryColor(categoryId));
+    drawText(CATEGORIES[categoryId], 80, 242, 14, BG_WHITE);
+    if (hotels.flags[h] & HOTEL_DEAL){
         drawRoundedBox(175, 235, 100, 30, D_RED);
-        drawText(to_string((int)hotel.dealPercent) + "% OFF!", 195, 242, 14, BG_WHITE);
+        drawText(to_string((int)hotels.dealPercent[h]) + "% OFF!", 195, 242, 14, BG_WHITE);
     }
     //Amenities icons (simple text-based list)
     drawText("Amenities:", 60, 285, 16, BLACK);
     int amenX = 60;
-    if (hotel.hasWifi) { drawText("WiFi", amenX, 315, 14, GRAY); amenX += 70; }
-    if (hotel.hasPool) { drawText("Pool", amenX, 315, 14, GRAY); amenX += 70; }
+    if (hotels.flags[h] & HOTEL_WIFI) { drawText("WiFi", amenX, 315, 14, GRAY); amenX += 70; }
+    if (hotels.flags[h] & HOTEL_POOL) { drawText("Pool", amenX, 315, 14, GRAY); amenX += 70; }
     drawText("AC", amenX, 315, 14, GRAY);
-    drawText("Price: Rs." + to_string((int)hotel.currentPrice) + "/night", 60, 380, 22, PAK_GREEN);
+    drawText("Price: Rs." + to_string((int)currentPrice) + "/night", 60, 380, 22, PAK_GREEN);
     //Date selection
     drawText("Check-in Date:", 550, 285, 16, BLACK);
-    string dateDisplay = formatDate(bookingDay, bookingMonth, bookingYear);
+    string dateDisplay = formatDate(bookingDate);
     drawText(dateDisplay, 700, 285, 16, Color{0, 102, 51, 255});
+    CivilDate checkIn = civilFromDays(bookingDate);
     
     drawText("Day:", 550, 320, 14, GRAY);
-    if (drawSmallButton(600, 315, 30, 25, "-", GRAY) && bookingDay > 1) bookingDay--;
-    drawText(to_string(bookingDay), 645, 320, 14, BLACK);
-    if (drawSmallButton(680, 315, 30, 25, "+", GRAY) && bookingDay < 28) bookingDay++;
+    if (drawSmallButton(600, 315, 30, 25, "-", GRAY)) bookingDate = max(appDate, stepDay(bookingDate, -1));
+    drawText(to_string(checkIn.day), 645, 320, 14, BLACK);
+    if (drawSmallButton(680, 315, 30, 25, "+", GRAY)) bookingDate = stepDay(bookingDate, 1);
     
     drawText("Month:", 550, 355, 14, GRAY);
-    if (drawSmallButton(620, 350, 30, 25, "-", GRAY) && bookingMonth > 1) bookingMonth--;
-    drawText(to_string(bookingMonth), 665, 355, 14, BLACK);
-    if (drawSmallButton(700, 350, 30, 25, "+", GRAY) && bookingMonth < 12) bookingMonth++;
+    if (drawSmallButton(620, 350, 30, 25, "-", GRAY)) bookingDate = max(appDate, stepMonth(bookingDate, -1));
+    drawText(to_string(checkIn.month), 665, 355, 14, BLACK);
+    if (drawSmallButton(700, 350, 30, 25, "+", GRAY)) bookingDate = stepMonth(bookingDate, 1);
     //Nights and Guests
     drawText("Nights:", 60, 360, 16, BLACK);
     if (drawSmallButton(140, 355, 35, 30, "-", GRAY) && nights > 1) nights--;
@@ -1333,13 +4677,16 @@ void drawDetailScreen(){
     int roomsNeeded = (guests + MAX_GUESTS_PER_ROOM - 1) / MAX_GUESTS_PER_ROOM;
     string roomInfo = "Rooms needed: " + to_string(roomsNeeded) + " (max 4 guests/room)";
     drawText(roomInfo, 60, 450, 14, GRAY);
+    int roomsLeft = roomsAvailable(h, bookingDate, nights);
+    drawText("Rooms free for these dates: " + to_string(roomsLeft), 60, 472, 14,
+             roomsLeft < roomsNeeded ? D_RED : GRAY);
     //Price calculation
-	float priceMultiplier = getPriceMultiplier(hotel);
-	float effectivePrice = hotel.currentPrice * priceMultiplier;
-	float total = effectivePrice * nights * roomsNeeded;
+	float priceMultiplier = getPriceMultiplier(h);
+	float stayPrice = quoteStay(h, daysFromToday(bookingDate), nights);
+	float total = stayPrice * priceMultiplier * roomsNeeded;
     drawRoundedBox(30, 540, 964, 90, PAK_GREEN);
     
-    string priceInfo = "Rs." + to_string((int)hotel.currentPrice) + "/night x " + 
+    string priceInfo = "Avg Rs." + to_string((int)(stayPrice / nights)) + "/night x " + 
                        to_string(nights) + " nights x " + to_string(roomsNeeded) + " rooms";
     drawText(priceInfo, 60, 555, 14, Color{200, 255, 200, 255});
     string totalText = "Total: Rs." + to_string((int)total);
@@ -1358,14 +4705,27 @@ drawText(modeText, 320, 592, 14, Color{200, 255, 200, 255});
         drawRoundedBox(550, 500, 280, 30, Color{234, 179, 8, 255});
         drawText("Exceeds Plan Goal (suggestion)", 565, 507, 12, BLACK);
     }
+    if (hasDateConflictSimple(bookingDate, nights)) {
+        drawRoundedBox(550, 460, 280, 30, Color{234, 179, 8, 255});
+        drawText("Overlaps another of your trips", 570, 467, 12, BLACK);
+    }
     //Book button
     if (drawButton(750, 570, 220, 50, "Book Now", Color{34, 197, 94, 255})) {
-        if (exceedsBudget){
+        int bookedSlot;
+        //The day can turn while this screen is open
+        if (isDateInPast(bookingDate)){
+            messageText = "Booking Failed!\nThe check-in date has passed.";
+            currentScreen = SCREEN_MESSAGE;}
+        else if (exceedsBudget){
             messageText = "Booking Failed!\nExceeds your budget: Rs." + to_string((int)user.maxBudget);
             currentScreen = SCREEN_MESSAGE;}
-        else if (createBooking(selectedHotelIndex, nights, guests)){
-            const Booking& b = bookings[bookingCount - 1];
-            messageText = "Booking Confirmed!\nID: " + b.bookingId + 
+        else if (roomsLeft < roomsNeeded){
+            messageText = "Booking Failed!\nOnly " + to_string(roomsLeft) + " rooms free on those dates.";
+            currentScreen = SCREEN_MESSAGE;}
+        else if ((bookedSlot = createBooking(selectedHotelIndex, bookingDate, nights, guests)) != -1){
+            requestJournalCommit();
+            const Booking& b = bookingAt(bookedSlot);
+            messageText = "Booking Confirmed!\nID: " + to_string(b.bookingId) + 
                           "\n" + to_string(nights) + " nights, " + to_string(guests) + 
                           " guests (" + to_string(roomsNeeded) + " rooms)" +
                           "\nTotal: Rs." + to_string((int)b.totalCost);
@@ -1380,12 +4740,7 @@ void drawBookingsScreen() {
     drawScreenHeader("My Bookings", SCREEN_HOME);
     //Header showing the current financial summary
     drawText("Your Budget: Rs." + to_string((int)user.maxBudget) + " | Spent: Rs." + to_string((int)user.totalSpent), 650, 28, 14, Color{0, 102, 51, 255});
-    //Count active bookings
-    int activeCount = 0;
-    for (int i = 0; i < bookingCount; i++){
-        if (bookings[i].isActive) activeCount++;
-    }
-    if (activeCount == 0){
+    if (bookingStore.live.empty()){
         int noBookingsWidth = measureText("No bookings yet!", 26);
         drawText("No bookings yet!", (WINDOW_WIDTH - noBookingsWidth) / 2, 350, 26, GRAY);
         int exploreWidth = measureText("Start exploring Pakistan!", 20);
@@ -1395,14 +4750,14 @@ void drawBookingsScreen() {
     int y = 85;
     int cardHeight = 130;
     
-    for (int i = 0; i < bookingCount; i++){
-        const Booking& b = bookings[i];
-        if (!b.isActive) continue;
+    for (int k = 0; k < (int)bookingStore.live.size(); k++){
+        int slot = bookingStore.live[k];
+        const Booking& b = bookingAt(slot);
         drawRoundedBox(30, y, 960, cardHeight, BG_WHITE);
-        drawRoundedBox(30, y, 10, cardHeight, getCityColor(b.city));
+        drawRoundedBox(30, y, 10, cardHeight, getCityColor(findCityId(b.city)));
         drawText(b.hotelName, 60, y + 15, 22, BLACK);
         //booking id
-        string info = "Booking ID: " + b.bookingId + " | City: " + b.city;
+        string info = "Booking ID: " + to_string(b.bookingId) + " | City: " + b.city;
         drawText(info, 60, y + 50, 16, GRAY);
         //booking details
         string details = to_string(b.nights) + " nights | " + 
@@ -1410,7 +4765,7 @@ void drawBookingsScreen() {
                          to_string(b.rooms) + " rooms";
         drawText(details, 60, y + 75, 16, GRAY);
         
-        string dates = b.checkInDate + " to " + b.checkOutDate;
+        string dates = formatDate(b.checkIn) + " to " + formatDate(b.checkOut);
         drawText(dates, 60, y + 100, 14, Color{0, 102, 51, 255});
         //total cost
         string total = "Rs." + to_string((int)b.totalCost);
@@ -1418,18 +4773,20 @@ void drawBookingsScreen() {
 
 		// Edit button
         if (drawButton(810, y + 55, 80, 32, "Edit", Color{59, 130, 246, 255})) {
-            selectedBookingIndex = i;
+            selectedBooking = bookingHandle(slot);
             editNights = b.nights;
             editGuests = b.guests;
-            parseDate(b.checkInDate, editDay, editMonth, editYear);
+            editDate = b.checkIn;
             currentScreen = SCREEN_EDIT_BOOKING;
         }
         
         //Cancel button
         if (drawButton(810, y + 70, 80, 32, "Cancel", D_RED)) {
-            if (cancelBooking(i)) {
+            if (cancelBooking(bookingHandle(slot))) {
+                requestJournalCommit();
                 messageText = "Booking cancelled successfully!";
                 currentScreen = SCREEN_MESSAGE;
+                break;
             }
         }
         
@@ -1438,22 +4795,17 @@ void drawBookingsScreen() {
 }
 
 void drawEditBookingScreen() {
-    if (selectedBookingIndex < 0 || selectedBookingIndex >= bookingCount) {
+    //The booking may have been cancelled or completed since it was picked
+    Booking* selected = findBooking(selectedBooking);
+    if (selected == NULL) {
         currentScreen = SCREEN_BOOKINGS;
         return;
     }
     
-    Booking& booking = bookings[selectedBookingIndex];
-    Hotel* hotel = nullptr;
-    
-    for (int i = 0; i < hotelCount; i++) {
-        if (hotels[i].name == booking.hotelName && hotels[i].city == booking.city) {
-            hotel = &hotels[i];
-            break;
-        }
-    }
+    Booking& booking = *selected;
+    int hotel = booking.hotelId;
     
-    if (hotel == nullptr) {
+    if (hotel == -1) {
         currentScreen = SCREEN_BOOKINGS;
         return;
     }
@@ -1465,18 +4817,19 @@ void drawEditBookingScreen() {
     drawText("City: " + booking.city, 60, 140, 14, GRAY);
     
     drawText("Check-in Date:", 60, 180, 16, BLACK);
-    string dateDisplay = formatDate(editDay, editMonth, editYear);
+    string dateDisplay = formatDate(editDate);
     drawText(dateDisplay, 400, 180, 16, PAK_GREEN);
+    CivilDate checkIn = civilFromDays(editDate);
     
     drawText("Day:", 60, 220, 14, GRAY);
-    if (drawSmallButton(120, 215, 30, 25, "-", GRAY) && editDay > 1) editDay--;
-    drawText(to_string(editDay), 160, 220, 14, BLACK);
-    if (drawSmallButton(190, 215, 30, 25, "+", GRAY) && editDay < 28) editDay++;
+    if (drawSmallButton(120, 215, 30, 25, "-", GRAY)) editDate = max(appDate, stepDay(editDate, -1));
+    drawText(to_string(checkIn.day), 160, 220, 14, BLACK);
+    if (drawSmallButton(190, 215, 30, 25, "+", GRAY)) editDate = stepDay(editDate, 1);
     
     drawText("Month:", 250, 220, 14, GRAY);
-    if (drawSmallButton(320, 215, 30, 25, "-", GRAY) && editMonth > 1) editMonth--;
-    drawText(to_string(editMonth), 360, 220, 14, BLACK);
-    if (drawSmallButton(390, 215, 30, 25, "+", GRAY) && editMonth < 12) editMonth++;
+    if (drawSmallButton(320, 215, 30, 25, "-", GRAY)) editDate = max(appDate, stepMonth(editDate, -1));
+    drawText(to_string(checkIn.month), 360, 220, 14, BLACK);
+    if (drawSmallButton(390, 215, 30, 25, "+", GRAY)) editDate = stepMonth(editDate, 1);
     
     drawText("Nights:", 60, 270, 16, BLACK);
     if (drawSmallButton(140, 265, 35, 30, "-", GRAY) && editNights > 1) editNights--;
@@ -1491,12 +4844,9 @@ void drawEditBookingScreen() {
     int roomsNeeded = (editGuests + MAX_GUESTS_PER_ROOM - 1) / MAX_GUESTS_PER_ROOM;
     drawText("Rooms: " + to_string(roomsNeeded), 60, 320, 14, GRAY);
     
-    int checkoutDay, checkoutMonth, checkoutYear;
-    calculateCheckoutDate(editDay, editMonth, editYear, editNights, checkoutDay, checkoutMonth, checkoutYear);
-    
-    drawText("Checkout: " + formatDate(checkoutDay, checkoutMonth, checkoutYear), 60, 350, 14, GRAY);
+    drawText("Checkout: " + formatDate(editDate + editNights), 60, 350, 14, GRAY);
     
-    float newCost = hotel->currentPrice * editNights * roomsNeeded;
+    float newCost = quoteStay(hotel, daysFromToday(editDate), editNights) * roomsNeeded;
     
     drawRoundedBox(60, 400, 400, 80, PAK_GREEN);
     drawText("New Total Cost", 100, 420, 14, BG_WHITE);
@@ -1509,31 +4859,32 @@ void drawEditBookingScreen() {
     string diffText = (difference > 0 ? "+" : "") + to_string((int)difference);
     drawText("Rs." + diffText, 540, 450, 24, diffColor);
 
-    bool exceedsBudget = user.maxBudget > 0 && 
+    bool exceedsBudget = user.maxBudget > 0 && newCost > booking.totalCost &&
                          (user.totalSpent - booking.totalCost + newCost) > user.maxBudget;
     
     if (exceedsBudget) {
         drawRoundedBox(60, 510, 840, 30, D_RED);
         drawText("New total would exceed budget!", 100, 517, 14, BG_WHITE);
     }
+    if (hasDateConflict(editDate, editNights, selectedBooking.slot)) {
+        drawRoundedBox(60, 545, 840, 28, Color{234, 179, 8, 255});
+        drawText("Overlaps another of your trips", 100, 551, 14, BLACK);
+    }
     
     if (drawButton(150, 580, 200, 50, "Update", Color{34, 197, 94, 255})) {
-        if (!exceedsBudget) {
-            user.totalSpent -= booking.totalCost;
-            booking.nights = editNights;
-            booking.guests = editGuests;
-            booking.rooms = roomsNeeded;
-            booking.totalCost = newCost;
-            booking.checkInDate = formatDate(editDay, editMonth, editYear);
-            booking.checkOutDate = formatDate(checkoutDay, checkoutMonth, checkoutYear);
-            user.totalSpent += newCost;
-            
-            saveGame();
-            messageText = "Booking updated successfully!";
+        if (isDateInPast(editDate)) {
+            messageText = "Cannot update:\nThe check-in date has passed.";
             currentScreen = SCREEN_MESSAGE;
-        } else {
+        } else if (exceedsBudget) {
             messageText = "Cannot update: Exceeds budget!";
             currentScreen = SCREEN_MESSAGE;
+        } else if (!updateBooking(selectedBooking, editDate, editNights, editGuests)) {
+            messageText = "Cannot update:\nNot enough rooms free on those dates!";
+            currentScreen = SCREEN_MESSAGE;
+        } else {
+            requestJournalCommit();
+            messageText = "Booking updated successfully!";
+            currentScreen = SCREEN_MESSAGE;
         }
     }
     if (drawButton(674, 580, 200, 50, "Cancel", D_RED)) {
@@ -1619,6 +4970,8 @@ void drawSearchScreen() {
     if (inputFieldActive == 1) handleTextInput(searchCity, 30);
     if (inputFieldActive == 2) handleTextInput(searchCategory, 30);
     
+    const FacetCounts& counts = getFacetCounts(searchName, searchCity, searchCategory,
+                                               searchMinPrice, searchMaxPrice, searchAmenities);
     drawRoundedBox(480, 75, 500, 250, BG_WHITE);
     drawText("Quick Select City:", 510, 95, 14, BLACK);
     int qx = 510, qy = 125;
@@ -1629,7 +4982,8 @@ void drawSearchScreen() {
     qx += 60;
     
     for (int i = 0; i < MAX_CITIES; i++) {
-        if (drawSmallButton(qx, qy, 100, 28, CITIES[i], getCityColor(CITIES[i]))) {
+        string cityLabel = CITIES[i] + " (" + to_string(counts.cityCount[i]) + ")";
+        if (drawSmallButton(qx, qy, 100, 28, cityLabel, getCityColor(i))) {
             searchCity = CITIES[i];
         }
         qx += 110;
@@ -1639,38 +4993,75 @@ void drawSearchScreen() {
     drawText("Quick Select Category:", 510, 220, 14, BLACK);
     qx = 510; qy = 250;
     for (int i = 0; i < MAX_CATEGORIES; i++) {
-        if (drawSmallButton(qx, qy, 85, 28, CATEGORIES[i], getCategoryColor(CATEGORIES[i]))) {
+        string categoryLabel = CATEGORIES[i] + " (" + to_string(counts.categoryCount[i]) + ")";
+        if (drawSmallButton(qx, qy, 85, 28, categoryLabel, getCategoryColor(i))) {
             searchCategory = CATEGORIES[i];
         }
         qx += 95;
     }
+
+    //Amenity toggles, each shows how many current results have it
+    drawText("Must have:", 510, 295, 14, BLACK);
+    const unsigned char amenityFlags[3] = {HOTEL_WIFI, HOTEL_POOL, HOTEL_DEAL};
+    const string amenityNames[3] = {"WiFi", "Pool", "Deals"};
+    const int amenityCounts[3] = {counts.wifiCount, counts.poolCount, counts.dealCount};
+    qx = 605;
+    for (int i = 0; i < 3; i++) {
+        bool on = (searchAmenities & amenityFlags[i]) != 0;
+        string amenityLabel = amenityNames[i] + " (" + to_string(amenityCounts[i]) + ")";
+        if (drawSmallButton(qx, 290, 110, 28, amenityLabel, on ? PAK_GREEN : GRAY)) {
+            searchAmenities ^= amenityFlags[i];
+        }
+        qx += 120;
+    }
     
-    int results[MAX_HOTELS];
-    int resultCount = SearchHotels(results, MAX_HOTELS, searchName, searchCity, searchCategory, searchMinPrice, searchMaxPrice);
+    const SearchCacheEntry& results = searchCachedEntry(searchName, searchCity, searchCategory,
+                                                        searchMinPrice, searchMaxPrice, searchAmenities);
+    int resultCount = (int)results.results.size();
+    if (results.generation != searchPageGeneration) {
+        //Different result set, start again from the top
+        searchPageGeneration = results.generation;
+        resetResultScroll();
+    }
 
     string resultText = "Found: " + to_string(resultCount) + " destinations";
     drawText(resultText, 40, 375, 16, BLACK);
+    drawText(to_string(countFreeTonight(results)) + " with rooms free tonight", 40, 394, 12, GRAY);
+    string cacheText = "Search cache: " + to_string(searchCacheHits) + " hits / " + to_string(searchCacheMisses) +
+                       " misses (" + to_string(refinedSearches) + " refined)";
+    drawText(cacheText, 720, 375, 12, GRAY);
+
+    //Sort order
+    drawText("Sort:", 370, 377, 12, GRAY);
+    for (int k = 0; k < RANK_KEY_COUNT; k++) {
+        if (drawSmallButton(405 + k * 60, 372, 55, 26, RANK_KEY_NAMES[k], searchSortKey == k ? PAK_GREEN : GRAY)) {
+            searchSortKey = k;
+            resetResultScroll();
+        }
+    }
     
     int maxVisible = 4;
+    const SearchPage& page = getResultPage(results, searchSortKey, maxVisible);
+    if (page.count == 0 && resultCount > 0) resetResultScroll();  // prices moved past the cursor
     if (scrollPosition > 0 && drawButton(200, 370, 70, 30, "Up", GRAY)) {
-        scrollPosition--;
+        scrollResultsUp();
     }
     if (scrollPosition + maxVisible < resultCount && drawButton(280, 370, 70, 30, "Down", GRAY)) {
-        scrollPosition++;
+        scrollResultsDown(page);
     }
     
-    if (scrollPosition >= resultCount) scrollPosition = 0;
+    if (scrollPosition >= resultCount) resetResultScroll();
     
     int y = 410;
-    for (int idx = scrollPosition; idx < resultCount && idx < scrollPosition + maxVisible; idx++) {
-        int i = results[idx];
-        const Hotel& h = hotels[i];
+    for (int idx = 0; idx < page.count; idx++) {
+        int i = page.hotelIds[idx];
+        int cityId = hotels.cityId[i];
         
         drawRoundedBox(40, y, 940, 75, BG_WHITE);
-        drawRoundedBox(40, y, 8, 75, getCityColor(h.city));
+        drawRoundedBox(40, y, 8, 75, getCityColor(cityId));
         
-        drawText(h.name, 65, y + 10, 18, BLACK);
-        string info = h.city + " | " + h.category + " | Rs." + to_string((int)h.currentPrice) + "/night";
+        drawText(getHotelName(i), 65, y + 10, 18, BLACK);
+        string info = CITIES[cityId] + " | " + CATEGORIES[hotels.categoryId[i]] + " | Rs." + to_string((int)hotels.currentPrice[i]) + "/night";
         drawText(info, 65, y + 38, 14, GRAY);
         
         Rectangle cardRect = {40, (float)y, 940, 75};
@@ -1678,9 +5069,7 @@ void drawSearchScreen() {
             selectedHotelIndex = i;
             nights = 1;
             guests = 2;
-            bookingDay = appDay;
-            bookingMonth = appMonth;
-            bookingYear = appYear;
+            bookingDate = appDate;
             currentScreen = SCREEN_DETAIL;
         }
         
@@ -1693,7 +5082,8 @@ void drawPlannerScreen() {
     DrawRectangle(0, 0, 1024, 60, BG_WHITE);
 
     if (drawButton(15, 12, 40, 40, "<", GRAY)) {
-        saveGame();
+        journalSettings();
+        requestJournalCommit();
         currentScreen = SCREEN_HOME;
     }
 
@@ -1812,7 +5202,8 @@ void drawSettingsScreen() {
     DrawRectangle(0, 0, 1024, 60, BG_WHITE);
 
     if (drawButton(15, 12, 40, 40, "<", GRAY)) {
-        saveGame();
+        journalSettings();
+        requestJournalCommit();
         currentScreen = SCREEN_HOME;
     }
 
@@ -1857,29 +5248,34 @@ void drawSettingsScreen() {
     int px = 240;
     int py = 405;
     for (int i = 0; i < MAX_CITIES; i++){
-        bool selected = isCityPreferred(CITIES[i]);
-        Color cityBtnColor = selected ? getCityColor(CITIES[i]) : GRAY;
+        bool selected = isCityPreferred(i);
+        Color cityBtnColor = selected ? getCityColor(i) : GRAY;
         if (drawSmallButton(px, py, 100, 30, CITIES[i], cityBtnColor)){
-            togglePreferredCity(CITIES[i]);
+            togglePreferredCity(i);
         }
         px += 110;
         if (px > 700) { px = 240; py += 38; }
     }
 
+	//Background save status
+	drawText(persistenceStatus(), 40, 660, 16, DARKGRAY);
+
 	if (drawButton(40, 690, 130, 45, "Planner", Color{59, 130, 246, 255})) {
-    saveGame();
+    journalSettings();
+    requestJournalCommit();
     currentScreen = SCREEN_PLANNER;
 }
 
 	if (drawButton(185, 690, 130, 45, "Reset All", Color{239, 68, 68, 255})) {
 	    string savedName = user.name;
 	    float savedBudget = user.maxBudget;
-	    initializeApp();
+	    {
+	        lock_guard<DayLock> day(dayLock);
+	        appDate = APP_START_DATE;
+	        initializeApp();
+	    }
 	    user.name = savedName;
 	    user.maxBudget = savedBudget;
-	    appDay = 20;
-	    appMonth = 12;
-	    appYear = 2025;
 	    dateTimer = 0;
 	    saveGame();
 	    messageText = "All data has been reset!\n(Name kept)";
@@ -1887,14 +5283,29 @@ void drawSettingsScreen() {
 		}		
 
 	if (drawButton(330, 690, 160, 45, "Reset & Restart", Color{168, 85, 247, 255})) {
+	    forgetTraveler(currentUserKey);
 	    initializeApp();
-	    remove("musafir_save.txt");
+	    flushPersistence();
+	    remove(SAVE_FILE);
+	    remove(TEXT_SAVE_FILE);
+	    remove(JOURNAL_FILE);
+	    {
+	        lock_guard<mutex> lock(persistence.lock);
+	        persistence.lastSnapshot.clear();
+	    }
 	    currentScreen = SCREEN_LOGIN;
 	}
 
 	if (drawButton(505, 690, 140, 45, "Save & Quit", Color{34, 197, 94, 255})) {
 	    saveGame();
-	    CloseWindow();
+	    quitRequested = true;
+	}
+
+	if (drawButton(660, 690, 170, 45, "Switch Traveler", Color{59, 130, 246, 255})) {
+	    saveGame();
+	    parkTraveler();
+	    inputText = "";
+	    currentScreen = SCREEN_LOGIN;
 	}
 }
 void drawSummaryScreen() {
@@ -1958,7 +5369,148 @@ void drawSummaryScreen() {
     
     drawText("Good job exploring Pakistan!", 340, 565, 18, Color{0, 102, 51, 255});
 }
-int main(){
+struct StressResult {
+    double seconds;
+    int failures;
+};
+//One stress run from a fresh state: threads create, move and cancel
+//bookings while the main thread ticks days, then the inventory, indexes
+//and budget are checked against the live bookings
+StressResult stressRun(int threadCount, long long operations) {
+    appDate = APP_START_DATE;
+    initializeApp();
+    user.name = "Stress Test";
+    user.maxBudget = 5000000;
+    atomic<bool> overBudget(false);
+    atomic<int> running(threadCount);
+    atomic<long long> created(0), moved(0), cancelled(0);
+    auto checkBudget = [&]() {
+        if (user.totalSpent > user.maxBudget) overBudget = true;
+    };
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threadCount; t++) {
+        workers.emplace_back([&, t]() {
+            mt19937 rng(7919 * t + 1);
+            vector<BookingHandle> mine;
+            for (long long i = 0; i < operations; i++) {
+                DayNumber today;
+                {
+                    shared_lock<DayLock> day(dayLock);
+                    today = appDate;
+                }
+                int op = rng() % 10;
+                if (op < 5 || mine.empty()) {
+                    int slot = createBooking(rng() % hotelCount, today + rng() % 60, 1 + rng() % 7, 1 + rng() % 8);
+                    if (slot != -1) {
+                        lock_guard<mutex> lock(accountMutex);
+                        mine.push_back(bookingHandle(slot));
+                        created++;
+                    }
+                    checkBudget();
+                } else if (op < 8) {
+                    size_t k = rng() % mine.size();
+                    if (cancelBooking(mine[k])) cancelled++;
+                    mine[k] = mine.back();
+                    mine.pop_back();
+                } else {
+                    size_t k = rng() % mine.size();
+                    if (updateBooking(mine[k], today + rng() % 60, 1 + rng() % 7, 1 + rng() % 8)) moved++;
+                    checkBudget();
+                }
+            }
+            running--;
+        });
+    }
+    //The day tick runs alongside the booking threads, as in the app
+    int days = 0;
+    while (running > 0) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        advanceDay();
+        if (hasDueEvents()) runDueEvents();
+        days++;
+    }
+    for (int t = 0; t < threadCount; t++) workers[t].join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    //Everything below runs single-threaded again
+    int failures = 0;
+    auto check = [&](bool ok, const char* what) {
+        if (!ok) {
+            printf("FAIL: %s\n", what);
+            failures++;
+        }
+    };
+    check(!overBudget, "budget exceeded during the run");
+    //Nights before today are dropped lazily, only later ones are compared
+    vector<map<DayNumber, int>> nights = hotelNights;
+    for (int h = 0; h < hotelCount; h++) nights[h].erase(nights[h].begin(), nights[h].lower_bound(appDate));
+    map<DayNumber, NightInventory> inventory = roomInventory;
+    buildRoomInventory();
+    bool roomsMatch = inventory.size() == roomInventory.size();
+    for (int h = 0; h < hotelCount; h++) {
+        if (nights[h] != hotelNights[h]) roomsMatch = false;
+        for (auto& night : nights[h]) {
+            if (night.second > hotels.roomCount[h]) roomsMatch = false;
+        }
+    }
+    for (auto& day : inventory) {
+        auto rebuilt = roomInventory.find(day.first);
+        if (rebuilt == roomInventory.end() || rebuilt->second.hotelsBooked != day.second.hotelsBooked) {
+            roomsMatch = false;
+            continue;
+        }
+        for (int h = 0; h < hotelCount; h++) {
+            if (bitmapTest(day.second.soldOut, h) != bitmapTest(rebuilt->second.soldOut, h) ||
+                bitmapTest(day.second.booked, h) != bitmapTest(rebuilt->second.booked, h)) roomsMatch = false;
+        }
+    }
+    check(roomsMatch, "room inventory differs from the live bookings");
+    vector<int> perHotel(hotelCount, 0);
+    for (int slot : bookingStore.live) perHotel[bookingAt(slot).hotelId]++;
+    check(perHotel == hotelActiveBookings, "active booking counts differ");
+    check(stayIndex.byCheckIn.size() == bookingStore.live.size(), "stay index size differs");
+    bool idsMatch = true;
+    for (int slot : bookingStore.live) {
+        if (findBookingById(bookingAt(slot).bookingId) != slot) idsMatch = false;
+    }
+    check(idsMatch, "booking id index differs");
+
+    long long total = threadCount * operations;
+    printf("%d threads, %lld operations in %.2fs (%.0f/s), %d days ticked\n",
+           threadCount, total, seconds, total / seconds, days);
+    printf("%lld created, %lld moved, %lld cancelled, %d live\n",
+           (long long)created, (long long)moved, (long long)cancelled, (int)bookingStore.live.size());
+    StressResult result = {seconds, failures};
+    return result;
+}
+//Concurrent booking stress test. The same number of operations runs on one
+//thread and then spread over the given threads, so the speedup shows how
+//booking throughput scales with cores. Nothing is saved.
+//Usage: musafir --stress-test [threads] [operations per thread]
+int runStressTest(int threadCount, int operations) {
+    if (threadCount < 1) threadCount = 1;
+    if (operations < 1) operations = 1;
+    long long total = (long long)threadCount * operations;
+    StressResult single = stressRun(1, total);
+    StressResult spread = threadCount > 1 ? stressRun(threadCount, operations) : single;
+    printf("speedup with %d threads: %.2fx (%u cores)\n", threadCount, single.seconds / spread.seconds,
+           thread::hardware_concurrency());
+    int failures = single.failures + (threadCount > 1 ? spread.failures : 0);
+    printf(failures == 0 ? "OK\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
+int main(int argc, char* argv[]){
+    //Command line catalog converter: musafir --convert-catalog hotels.csv musafir_hotels.bin
+    if (argc == 4 && strcmp(argv[1], "--convert-catalog") == 0) {
+        return convertCatalogCsv(argv[2], argv[3]);
+    }
+    if (argc == 2 && strcmp(argv[1], "--self-test") == 0) {
+        return runSelfTest();
+    }
+    if (argc >= 2 && strcmp(argv[1], "--stress-test") == 0) {
+        return runStressTest(argc >= 3 ? atoi(argv[2]) : 8, argc >= 4 ? atoi(argv[3]) : 250000);
+    }
     InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Musafir - Pakistan Travel App"); //Initialize window
     SetTargetFPS(60);
     appFont = LoadFontEx("C:/Windows/Fonts/arial.ttf", 48, 0, 250);//for arial font
@@ -1966,8 +5518,9 @@ int main(){
         appFont = GetFontDefault();
     SetTextureFilter(appFont.texture, TEXTURE_FILTER_BILINEAR);
    srand((unsigned int)time(nullptr));
+    startPersistence();
 	
-    while (!WindowShouldClose()) {
+    while (!WindowShouldClose() && !quitRequested) {
         // Update app date timer
         dateTimer += GetFrameTime();
         if (dateTimer >= 120.0f) {  // Every 2 minutes
@@ -1975,28 +5528,11 @@ int main(){
             advanceDay();
         }
         
-        // Check for completed trips
-        for (int i = 0; i < bookingCount; i++) {
-            if (!bookings[i].isActive) continue;
-
-            int coDay, coMonth, coYear;
-            parseDate(bookings[i].checkOutDate, coDay, coMonth, coYear);
-
-            bool checkoutPassed = (appYear > coYear) ||
-                (appYear == coYear && appMonth > coMonth) ||
-                (appYear == coYear && appMonth == coMonth && appDay >= coDay);
-
-            if (checkoutPassed) {
-                markHotelVisited(bookings[i].hotelName, bookings[i].city);
-                destinationsTravelled++;
-                if (user.placesVisited > 0) {
-                    user.placesVisited--;
-                }
-                bookings[i].isActive = false;
-                updateAchievements();
-                saveGame();
-            }
-        }
+        // Weather changes, deal ends and completed trips
+        if (hasDueEvents()) runDueEvents();
+        if (journal.compactWanted) saveGame();
+        pumpSaves(GetTime());
+        updateTextCache();
         
         BeginDrawing();
 
@@ -2017,7 +5553,9 @@ int main(){
         }
     EndDrawing();
     }
-    // Cleanup
+    // Cleanup: waits for the last saves, and the atlas goes before the window
+    stopPersistence();
+    unloadTextCache();
     CloseWindow();
     return 0;
 }